@@ -29,20 +29,106 @@
 #include <sstream>
 #include <cstdlib>
 #include <cmath>
+#include <algorithm>
 #include <FITSFile.h>
 #include <FITSImage.h>
 #include <FITSPosn.h>
 #include <parammm/parammm.hh>
-#include "binmodule.hh"
+#include "parallel.hh"
 #include "version.hh"
 
 using std::string;
 using std::vector;
 using std::ostringstream;
+using std::istringstream;
 using std::endl;
 using std::cerr;
 using std::cout;
 
+namespace {
+
+  // a --background switch sets the background of the last --image
+  // given (or the first image, if it comes before them)
+  class background_opt : public parammm::switch_opt
+  {
+  public:
+    background_opt(const vector<string> *images, vector<double> *bgs)
+      : m_images(images), m_bgs(bgs) {}
+    background_opt* makecopy() const
+    { return new background_opt(m_images, m_bgs); }
+
+  private:
+    void setfromstream(std::istream *stream) const
+    {
+      const unsigned i = m_images->empty() ? 0 : m_images->size()-1;
+      if( m_bgs->size() < i+1 )
+	m_bgs->resize(i+1, 0.);
+      *stream >> (*m_bgs)[i];
+    }
+
+    const vector<string> *m_images;
+    vector<double> *m_bgs;
+  };
+
+  // a value to work out for each bin from the input images
+  // count(a) - background subtracted counts/pixel of image a
+  // ratio(a,b) - ratio of the counts/pixel of images a and b
+  // hardness(a,b) - hardness ratio (a-b)/(a+b) of the counts/pixel
+  //                 (with an absolute rather than fractional error)
+  class value_spec
+  {
+  public:
+    enum valuet { vcount, vratio, vhardness };
+
+    bool parse(const string &spec, unsigned noinputs);
+    string descr() const;
+
+    valuet type;
+    unsigned a, b;
+  };
+
+  bool value_spec::parse(const string &spec, unsigned noinputs)
+  {
+    const string::size_type bracket = spec.find('(');
+    if( bracket == string::npos )
+      return false;
+
+    const string name = spec.substr(0, bracket);
+    istringstream n(spec.substr(bracket+1));
+    n >> a;
+    b = a;
+
+    if( name == "count" )
+      type = vcount;
+    else if( name == "ratio" || name == "hardness" ) {
+      type = name == "ratio" ? vratio : vhardness;
+      if( n.peek() == ',' ) n.ignore();
+      n >> b;
+    } else
+      return false;
+
+    return n && n.peek() == ')' && a < noinputs && b < noinputs;
+  }
+
+  string value_spec::descr() const
+  {
+    ostringstream o;
+    switch(type) {
+    case vcount:
+      o << "count(" << a << ")";
+      break;
+    case vratio:
+      o << "ratio(" << a << ", " << b << ")";
+      break;
+    case vhardness:
+      o << "hardness(" << a << ", " << b << ")";
+      break;
+    }
+    return o.str();
+  }
+
+}
+
 class abpixelcopy_program
 {
 public:
@@ -53,37 +139,62 @@ public:
 
 private:
   void bin_image();
+  void sum_rows(int y1, int y2, unsigned thread);
+  void evaluate_bin(int bin, const double *totals, const int *counts);
+  void paint_rows(int y1, int y2, unsigned thread);
   void add_history_list(CFITSFile *file);
 
 private:
-  string m_in_fname, m_binmap_fname, m_out_fname, m_err_fname;
+  // input images and their backgrounds
+  vector<string> m_in_fnames;
+  vector<double> m_backgrnds;
+  string m_binmap_fname;
+
+  // the values to output, and the output and error files (one each
+  // per value, or one cube of all of them)
+  vector<string> m_value_specs;
+  vector<value_spec> m_values;
+  vector<string> m_out_fnames, m_err_fnames;
+  bool m_cube;
 
   CFITSImage m_bin_image;
-  CFITSImage m_in_image;
-  CFITSImage m_out_image, m_err_image;
+  vector<CFITSImage> m_in_images;
   CFITSPosn m_in_posn;
-  double m_backgrnd;
   bool m_verbose;
+  int m_threads;    // number of threads (0 for all cpus)
+
+  // totals and counts of pixels in each bin (for each input), for
+  // each thread
+  vector< vector<double> > m_thread_totals;
+  vector< vector<int> > m_thread_counts;
+
+  // value and error of each bin (for each value)
+  vector<double> m_bin_values, m_bin_errors;
+
+  // output and error planes (one per value)
+  vector<CFloatType> m_out_planes, m_err_planes;
 
   vector<string> m_history_list;
 };
 
 abpixelcopy_program::abpixelcopy_program(int argc, char *argv[])
   : m_binmap_fname("adbin_binmap.fits"),
-    m_backgrnd(0.), m_verbose(false)
+    m_cube(false),
+    m_verbose(false),
+    m_threads(0)
 {
   parammm::param params(argc, argv);
   params.add_switch( parammm::pswitch("image", 'i',
-				      parammm::pstring_opt(&m_in_fname),
-				      "set input image file (req)",
+				      parammm::pstringlist_opt(&m_in_fnames),
+				      "add input image file (req, repeatable)",
 				      "FILE"));
   params.add_switch( parammm::pswitch("out", 'o',
-				      parammm::pstring_opt(&m_out_fname),
-				      "set out file (req)",
+				      parammm::pstringlist_opt(&m_out_fnames),
+				      "add out file (req, one per value)",
 				      "FILE"));
   params.add_switch( parammm::pswitch("err", 'e',
-				      parammm::pstring_opt(&m_err_fname),
-				      "set out error map (req)",
+				      parammm::pstringlist_opt(&m_err_fnames),
+				      "add out error map (req, one per value)",
 				      "FILE"));
   params.add_switch( parammm::pswitch("binmap", 'n',
 				      parammm::pstring_opt(&m_binmap_fname),
@@ -94,8 +205,23 @@ abpixelcopy_program::abpixelcopy_program(int argc, char *argv[])
 				      "set input pixel file (DISCOURAGED)",
 				      "FILE"));
   params.add_switch( parammm::pswitch("background", 'b',
-				      parammm::pdouble_opt(&m_backgrnd),
-				      "set background counts/pixel",
+				      background_opt(&m_in_fnames,
+						     &m_backgrnds),
+				      "set background counts/pixel of last "
+				      "image",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("value", 'v',
+				      parammm::pstringlist_opt(&m_value_specs),
+				      "add output value (def count of each "
+				      "image)",
+				      "STR"));
+  params.add_switch( parammm::pswitch("cube", 'c',
+				      parammm::pbool_noopt(&m_cube),
+				      "write values as planes of one cube",
+				      ""));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
 				      "VAL"));
   params.add_switch( parammm::pswitch("verbose", 0,
 				      parammm::pbool_noopt(&m_verbose),
@@ -104,8 +230,13 @@ abpixelcopy_program::abpixelcopy_program(int argc, char *argv[])
 
   params.set_autohelp("Usage: ABPixelCopy [OPTIONS] --image=in.fits "
 		      "--out=out.fits --err=err.fits\n"
-		      "Bins image using pixel file, creating output and error "
-		      "file.\nDoes background subtraction.\n"
+		      "Bins images using pixel file, creating output and "
+		      "error files.\nDoes background subtraction.\n"
+		      "Give --image (and --background) for each image, and "
+		      "--value for each output:\n"
+		      " count(a), ratio(a,b) or hardness(a,b), where "
+		      "hardness is (a-b)/(a+b)\n"
+		      "and images are numbered from 0.\n"
 		      "Written by Jeremy Sanders, 2000, 2001.",
 		      "Report bugs to <jss@ast.cam.ac.uk>");
   params.enable_autohelp();
@@ -115,8 +246,34 @@ abpixelcopy_program::abpixelcopy_program(int argc, char *argv[])
   params.enable_at_expansion();
   params.interpret_and_catch();
 
-  if( m_in_fname.empty() || m_out_fname.empty() || m_err_fname.empty() )
+  if( m_in_fnames.empty() || m_out_fnames.empty() || m_err_fnames.empty() )
     params.show_autohelp();
+  m_backgrnds.resize(m_in_fnames.size(), 0.);
+
+  // by default, the counts of each image
+  if( m_value_specs.empty() )
+    for(unsigned i=0; i<m_in_fnames.size(); ++i) {
+      ostringstream o;
+      o << "count(" << i << ")";
+      m_value_specs.push_back(o.str());
+    }
+
+  m_values.resize(m_value_specs.size());
+  for(unsigned i=0; i<m_value_specs.size(); ++i)
+    if( ! m_values[i].parse(m_value_specs[i], m_in_fnames.size()) ) {
+      cerr << "Invalid value " << m_value_specs[i] << '\n';
+      exit(1);
+    }
+
+  const unsigned nooutputs = m_cube ? 1 : m_values.size();
+  if( m_out_fnames.size() != nooutputs || m_err_fnames.size() != nooutputs ) {
+    cerr << "Give one --out and one --err file "
+	 << (m_cube ? "for the cube\n" : "for each value\n");
+    exit(1);
+  }
+
+  if( m_threads <= 0 )
+    m_threads = AdaptiveBin::default_threads();
 }
 
 abpixelcopy_program::~abpixelcopy_program()
@@ -136,10 +293,12 @@ void abpixelcopy_program::add_history_list(CFITSFile *file)
 void abpixelcopy_program::run()
 {
   // load images
-  {
-    CFITSFile infile(m_in_fname.c_str(), CFITSFile::existingro);
-    m_in_image = infile.GetImage();
-    m_in_posn = infile.GetPosn();
+  m_in_images.resize(m_in_fnames.size());
+  for(unsigned i=0; i<m_in_fnames.size(); ++i) {
+    CFITSFile infile(m_in_fnames[i].c_str(), CFITSFile::existingro);
+    m_in_images[i] = infile.GetImage();
+    if( i == 0 )
+      m_in_posn = infile.GetPosn();
   }{
     CFITSFile infile(m_binmap_fname.c_str(), CFITSFile::existingro);
     m_bin_image = infile.GetImage();
@@ -149,15 +308,13 @@ void abpixelcopy_program::run()
 
   m_history_list.push_back("file created by ABPixelCopy v. " +
 			   string(c_adbin_version));
-  m_history_list.push_back("input image: " + m_in_fname);
-  m_history_list.push_back("bin map (input): " + m_binmap_fname);
-  m_history_list.push_back("output image: " + m_out_fname);
-  m_history_list.push_back("error map: " + m_err_fname);
-  {
+  for(unsigned i=0; i<m_in_fnames.size(); ++i) {
     ostringstream o;
-    o << "background: " << m_backgrnd << '\0';
+    o << "input image " << i << ": " << m_in_fnames[i]
+      << " (background: " << m_backgrnds[i] << ")";
     m_history_list.push_back(o.str());
   }
+  m_history_list.push_back("bin map (input): " + m_binmap_fname);
 
   if(m_verbose) {
     cout << "\nHeaders written to output files:\n";
@@ -166,78 +323,207 @@ void abpixelcopy_program::run()
     cout << endl;
   }
 
-  // save image
-  {
-    CFITSFile outfile(m_out_fname.c_str(), CFITSFile::create);
-    outfile.SetImage(m_out_image);
-    //outfile.SetPosn(m_in_posn);
-    outfile.WriteImage();
-    outfile.WriteHistory("adbin: file is output image");
-    add_history_list(&outfile);
-  }{
-    CFITSFile outfile(m_err_fname.c_str(), CFITSFile::create);
-    outfile.SetImage(m_err_image);
-    //outfile.SetPosn(m_in_posn);
-    outfile.WriteImage();
-    outfile.WriteHistory("adbin: file is error map");
-    add_history_list(&outfile);
+  // save images
+  const int xw = m_bin_image.GetXW(), yw = m_bin_image.GetYW();
+  const long nopix = long(xw)*long(yw);
+  const int novalues = m_values.size();
+  const int noplanes = m_cube ? novalues : 1;
+
+  for(unsigned f=0; f<m_out_fnames.size(); ++f) {
+    {
+      CFITSFile outfile(m_out_fnames[f].c_str(), CFITSFile::create);
+      //outfile.SetPosn(m_in_posn);
+      outfile.WriteImageCube(&m_out_planes[f*nopix], xw, yw, noplanes);
+      outfile.WriteHistory("adbin: file is output image");
+      add_history_list(&outfile);
+      for(int p=0; p<noplanes; ++p) {
+	const string s = "adbin: value: " + m_values[f+p].descr();
+	outfile.WriteHistory(s.c_str());
+      }
+    }{
+      CFITSFile outfile(m_err_fnames[f].c_str(), CFITSFile::create);
+      //outfile.SetPosn(m_in_posn);
+      outfile.WriteImageCube(&m_err_planes[f*nopix], xw, yw, noplanes);
+      outfile.WriteHistory("adbin: file is error map");
+      add_history_list(&outfile);
+      for(int p=0; p<noplanes; ++p) {
+	const string s = "adbin: value: " + m_values[f+p].descr();
+	outfile.WriteHistory(s.c_str());
+      }
+    }
   }
 }
 
+// the bin map is read once, each thread adding up the pixels of its
+// rows into its own totals for each bin and image, and the bins are
+// then painted back in parallel
 void abpixelcopy_program::bin_image()
 {
-  // rewritten to avoid going through the image too many times
-
-  const int xw = m_in_image.GetXW();
-  const int yw = m_in_image.GetYW();
-
-  m_out_image.Resize(xw, yw);
-  m_out_image.SetAll( 0. / 0. );
-  m_err_image.Resize(xw, yw);
-
-  int max_bin = -1;
-  for(int y=0; y<yw; y++)
-    for(int x=0; x<xw; x++) {
-      const int bin = (int)m_bin_image.GetPixel(x, y);
-      if( bin > max_bin ) max_bin = bin;
+  const int xw = m_bin_image.GetXW();
+  const int yw = m_bin_image.GetYW();
+  const int noinputs = m_in_images.size();
+  const int novalues = m_values.size();
+
+  for(int i=0; i<noinputs; ++i)
+    if( m_in_images[i].GetXW() != xw || m_in_images[i].GetYW() != yw ) {
+      cerr << "Bin map is not the same size as input image "
+	   << m_in_fnames[i] << '\n';
+      exit(1);
     }
 
-  // collect lists of pixels in bins
-  vector<AdaptiveBin::pixlist> pixels_in_bins(max_bin+1);
-  for(int y=0; y<yw; y++)
-    for(int x=0; x<xw; x++) {
-      const int pix = (int)m_bin_image.GetPixel(x, y);
-      if( pix >= 0 and not isnan(m_in_image.GetPixel(x, y)) )
-	pixels_in_bins[pix].push_back( AdaptiveBin::pixel(x, y) );
+  m_out_planes.assign(long(xw)*long(yw)*novalues, 0. / 0.);
+  m_err_planes.assign(long(xw)*long(yw)*novalues, 0.);
+
+  m_thread_totals.assign(m_threads, vector<double>());
+  m_thread_counts.assign(m_threads, vector<int>());
+  AdaptiveBin::parallel_range(this, &abpixelcopy_program::sum_rows, yw,
+			      m_threads);
+
+  // add together the totals of the threads
+  int no_bins = 0;
+  for(int t=0; t<m_threads; ++t)
+    no_bins = std::max(no_bins, int(m_thread_counts[t].size()) / noinputs);
+
+  vector<double> totals(no_bins*noinputs, 0.);
+  vector<int> counts(no_bins*noinputs, 0);
+  for(int t=0; t<m_threads; ++t) {
+    const vector<double> &tt = m_thread_totals[t];
+    const vector<int> &tc = m_thread_counts[t];
+    for(int i=0; i<int(tc.size()); ++i) {
+      totals[i] += tt[i];
+      counts[i] += tc[i];
     }
+  }
+  m_thread_totals.clear();
+  m_thread_counts.clear();
 
   // do the binning
-  for(int bin_no=max_bin; bin_no>=0; --bin_no) {
-    double tot = 0.;
-    AdaptiveBin::pixlist &p = pixels_in_bins[bin_no];
-
-    if( p.size() == 0 ) {
+  m_bin_values.assign(no_bins*novalues, 0. / 0.);
+  m_bin_errors.assign(no_bins*novalues, 0.);
+  for(int bin_no=no_bins-1; bin_no>=0; --bin_no) {
+    const int *c = &counts[bin_no*noinputs];
+    if( std::count(c, c+noinputs, 0) == noinputs ) {
       cerr << "Warning - missing bin "
 	   << bin_no
 	   << " in bin map\n";
       continue;
     }
 
-    for(int i=p.size()-1; i>=0; --i) {
-      const double pix = m_in_image.GetPixel( p[i].x(), p[i].y() );
-      tot += pix;
+    evaluate_bin(bin_no, &totals[bin_no*noinputs], c);
+  }
+
+  AdaptiveBin::parallel_range(this, &abpixelcopy_program::paint_rows, yw,
+			      m_threads);
+}
+
+void abpixelcopy_program::sum_rows(int y1, int y2, unsigned thread)
+{
+  const int xw = m_bin_image.GetXW();
+  const int noinputs = m_in_images.size();
+  const CFloatType *binmap = m_bin_image.GetImageBuffer();
+  vector<double> &totals = m_thread_totals[thread];
+  vector<int> &counts = m_thread_counts[thread];
+
+  vector<const CFloatType*> in(noinputs);
+  for(int i=0; i<noinputs; ++i)
+    in[i] = m_in_images[i].GetImageBuffer();
+
+  for(int y=y1; y<y2; ++y)
+    for(int x=0; x<xw; ++x) {
+      const int bin = int( binmap[x+y*xw] );
+      if( bin < 0 )
+	continue;
+
+      // bins with no valid pixels are still counted, to warn about them
+      if( (bin+1)*noinputs > int(counts.size()) ) {
+	totals.resize((bin+1)*noinputs, 0.);
+	counts.resize((bin+1)*noinputs, 0);
+      }
+
+      for(int i=0; i<noinputs; ++i) {
+	const double pix = in[i][x+y*xw];
+	if( ! std::isnan(pix) ) {
+	  totals[bin*noinputs+i] += pix;
+	  ++counts[bin*noinputs+i];
+	}
+      }
     }
+}
+
+// work out the values for a bin from the totals and counts of the
+// valid pixels of each image
+void abpixelcopy_program::evaluate_bin(int bin, const double *totals,
+				       const int *counts)
+{
+  const int novalues = m_values.size();
 
-    const double av = tot/p.size() - m_backgrnd;
-    const double ferr = sqrt(tot + m_backgrnd*p.size()) /
-      (tot - m_backgrnd*p.size());
+  for(int v=0; v<novalues; ++v) {
+    const value_spec &spec = m_values[v];
+    const unsigned a = spec.a, b = spec.b;
+    if( counts[a] == 0 || counts[b] == 0 )
+      continue;
 
-    for(int i=p.size()-1; i>=0; --i) {
-      m_out_image.SetPixel(p[i].x(), p[i].y(), av);
-      m_err_image.SetPixel(p[i].x(), p[i].y(), ferr);
+    // background subtracted counts/pixel of each image, their errors
+    // (from the error in the total, sqrt(tot), and in the background)
+    // and the fractional errors
+    const double bga = m_backgrnds[a]*counts[a];
+    const double bgb = m_backgrnds[b]*counts[b];
+    const double ra = totals[a]/counts[a] - m_backgrnds[a];
+    const double rb = totals[b]/counts[b] - m_backgrnds[b];
+    const double ea = sqrt(totals[a] + bga) / counts[a];
+    const double eb = sqrt(totals[b] + bgb) / counts[b];
+    const double fa = sqrt(totals[a] + bga) / (totals[a] - bga);
+    const double fb = sqrt(totals[b] + bgb) / (totals[b] - bgb);
+
+    // the error is fractional, except for hardness ratios, which sit
+    // around 0 and so are given the absolute error
+    double val = 0., err = 0.;
+    switch(spec.type) {
+    case value_spec::vcount:
+      val = ra;
+      err = fa;
+      break;
+    case value_spec::vratio:
+      val = ra / rb;
+      err = sqrt(fa*fa + fb*fb);
+      break;
+    case value_spec::vhardness:
+      {
+	const double sum = ra + rb;
+	val = (ra - rb) / sum;
+	err = 2.*sqrt(rb*rb*ea*ea + ra*ra*eb*eb) / (sum*sum);
+      }
+      break;
     }
-  } // loop over bins
 
+    m_bin_values[bin*novalues+v] = val;
+    m_bin_errors[bin*novalues+v] = err;
+  }
+}
+
+void abpixelcopy_program::paint_rows(int y1, int y2, unsigned thread)
+{
+  const int xw = m_bin_image.GetXW(), yw = m_bin_image.GetYW();
+  const long nopix = long(xw)*long(yw);
+  const int novalues = m_values.size();
+  const CFloatType *binmap = m_bin_image.GetImageBuffer();
+
+  for(int v=0; v<novalues; ++v) {
+    const CFloatType *ina = m_in_images[m_values[v].a].GetImageBuffer();
+    const CFloatType *inb = m_in_images[m_values[v].b].GetImageBuffer();
+    CFloatType *out = &m_out_planes[v*nopix];
+    CFloatType *err = &m_err_planes[v*nopix];
+
+    for(int y=y1; y<y2; ++y)
+      for(int x=0; x<xw; ++x) {
+	const int i = x+y*xw;
+	const int bin = int( binmap[i] );
+	if( bin >= 0 && ! std::isnan(ina[i]) && ! std::isnan(inb[i]) ) {
+	  out[i] = m_bin_values[bin*novalues+v];
+	  err[i] = m_bin_errors[bin*novalues+v];
+	}
+      }
+  }
 }
 
 int main(int argc, char *argv[])
@@ -25,8 +25,16 @@
 // program to take an image, and adjust the size of annuli
 // until they contain a certain number of counts
 
+// With a catalogue of centres (--centres), annuli are made about each
+// centre in a square cutout of the image. A pixel in more than one
+// cutout belongs to the nearest centre (the first listed if equally
+// near), and pixels outside every cutout are set to -1, like masked
+// pixels. Bins are numbered centre by centre in catalogue order.
+
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <vector>
 #include <sstream>
 #include <fstream>
 #include <assert.h>
@@ -34,6 +42,9 @@
 #include <parammm/parammm.hh>
 #include <FITSFile.h>
 
+#include "parallel.hh"
+#include "maskimage.hh"
+#include "radiusmap.hh"
 #include "version.hh"
 
 using std::string;
@@ -41,11 +52,352 @@ using std::cout;
 using std::cerr;
 using std::endl;
 using std::ostringstream;
+using std::istringstream;
 using std::ifstream;
+using std::ofstream;
+using std::vector;
 
 const double c_masked = -1.;
 const double c_notdone = -2.;
 
+// settings shared by every centre
+struct annuli_settings
+{
+  double min_counts;       // minimum counts in each annulus
+  double bg_counts;        // background counts per pixel
+  double axis_ratio;       // minor/major axis ratio of elliptical annuli
+  double pa;               // position angle of major axis (deg)
+  int no_sectors;
+  double start_angle;      // angle sectors start at (deg)
+  bool indep_sectors;      // grow the radii of each sector separately
+  vector<double> fixed_radii;  // radii of fixed annuli (empty if adaptive)
+};
+
+// an output bin (an annulus in a sector)
+struct annulus_bin
+{
+  annulus_bin() : inner(0.), outer(0.), pixels(0), net_counts(0.) {}
+
+  double inner, outer;     // radii
+  int pixels;
+  double net_counts;       // background subtracted counts
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// makes annuli about one centre on an image (or a cutout of one)
+class annuli_maker
+{
+public:
+  annuli_maker(const annuli_settings &set, const CFITSImage &image,
+	       CFITSImage *binmap, double xc, double yc,
+	       unsigned nothreads);
+  // pixels in binmap set to c_notdone are binned, the rest are left
+
+  void create(std::ostream &log);
+
+  const vector<annulus_bin> &bins() const { return m_bins; }
+  // bins are numbered annulus*sectors + sector
+
+private:
+  void create_annuli(std::ostream &log);
+  void create_fixed_annuli();
+
+  int pixel_sector(int x, int y) const;
+
+  static int radius_step(double radius_sqd);
+  void build_radius_index();
+  void grow_annuli(int s1, int s2, std::ostream &log);
+  void grow_sectors(int s1, int s2, unsigned thread);
+
+private:
+  const annuli_settings &m_set;
+  const CFITSImage &m_image;
+  CFITSImage *m_binmap;
+  const int m_xw, m_yw;
+  const int m_no_sectors;
+  const unsigned m_nothreads;
+
+  const AdaptiveBin::radius_map m_radii;
+
+  // unbinned pixels (x+y*xw) sorted by sector, then by the radius step
+  // they are first included in, and where each step starts in the list
+  // the steps of sector s are s*m_no_steps ... (s+1)*m_no_steps-1
+  vector<int> m_sorted_pixels;
+  vector<int> m_step_start;
+  vector<double> m_step_counts;     // bg subtracted counts in each step
+  int m_no_steps;
+
+  vector< vector<annulus_bin> > m_sector_bins;  // annuli of each sector
+  vector<string> m_sector_logs;     // messages from each sector
+  vector<annulus_bin> m_bins;
+};
+
+annuli_maker::annuli_maker(const annuli_settings &set,
+			   const CFITSImage &image,
+			   CFITSImage *binmap, double xc, double yc,
+			   unsigned nothreads)
+  : m_set(set), m_image(image), m_binmap(binmap),
+    m_xw(image.GetXW()), m_yw(image.GetYW()),
+    m_no_sectors(set.no_sectors),
+    m_nothreads(nothreads),
+    // radii and sectors of pixels, shared by both modes
+    m_radii(m_xw, m_yw, xc, yc, set.axis_ratio, set.pa,
+	    set.no_sectors > 1, nothreads),
+    m_no_steps(0)
+{
+}
+
+void annuli_maker::create(std::ostream &log)
+{
+  if( ! m_set.fixed_radii.empty() )
+    create_fixed_annuli();
+  else
+    create_annuli(log);
+}
+
+// which sector a pixel is in
+int annuli_maker::pixel_sector(int x, int y) const
+{
+  if( m_no_sectors == 1 )
+    return 0;
+
+  const double rad_start = m_set.start_angle / 180. * M_PI;
+  const double rad_per_sector = (M_PI * 2.) / m_no_sectors;
+
+  // find sector
+  const double angle = m_radii.angle(x, y) - rad_start + M_PI;
+
+  // move sector into range 0 -> m_no_sectors-1
+  int sector = int(angle / rad_per_sector);
+  while( sector >= m_no_sectors )
+    sector -= m_no_sectors;
+  while(sector < 0)
+    sector += m_no_sectors;
+
+  return sector;
+}
+
+// annuli grow in steps of 0.5 pixels, and a pixel is inside step k
+// if its radius is less than 0.5*k
+// return the first step which includes a pixel at this radius
+int annuli_maker::radius_step(double radius_sqd)
+{
+  int step = int( 2.*sqrt(radius_sqd) ) + 1;
+
+  // correct any rounding in the sqrt
+  while( step > 1 && radius_sqd < 0.25*(step-1)*(step-1) )
+    --step;
+  while( radius_sqd >= 0.25*step*step )
+    ++step;
+
+  return step;
+}
+
+// sort the unbinned pixels by sector and radius step (a counting
+// sort), and total the counts in each step, so the annuli can be made
+// without scanning the image again
+void annuli_maker::build_radius_index()
+{
+  vector<int> pixel_key(m_xw*m_yw, -1);
+  vector<int> pixel_sector_no(m_xw*m_yw, 0);
+  int max_step = 0;
+
+  for(int y=0; y<m_yw; ++y)
+    for(int x=0; x<m_xw; ++x) {
+      if( fabs(m_binmap->GetPixel(x, y) - c_notdone) >= 1e-8 )
+	continue;
+
+      const int step = radius_step( m_radii.radius_sqd(x, y) );
+      pixel_key[x+y*m_xw] = step;
+      pixel_sector_no[x+y*m_xw] = pixel_sector(x, y);
+      if( step > max_step )
+	max_step = step;
+    }
+
+  // convert steps into sector and step index
+  m_no_steps = max_step+1;
+  for(int i=0; i<m_xw*m_yw; ++i)
+    if( pixel_key[i] >= 0 )
+      pixel_key[i] += pixel_sector_no[i]*m_no_steps;
+
+  const int no_keys = m_no_sectors*m_no_steps;
+  m_step_start.assign(no_keys+1, 0);
+  m_step_counts.assign(no_keys, 0.);
+  for(int i=0; i<m_xw*m_yw; ++i)
+    if( pixel_key[i] >= 0 )
+      ++m_step_start[pixel_key[i]+1];
+  for(int key=0; key<no_keys; ++key)
+    m_step_start[key+1] += m_step_start[key];
+
+  vector<int> next(m_step_start.begin(), m_step_start.end()-1);
+  m_sorted_pixels.resize(m_step_start[no_keys]);
+  for(int y=0; y<m_yw; ++y)
+    for(int x=0; x<m_xw; ++x) {
+      const int key = pixel_key[x+y*m_xw];
+      if( key < 0 )
+	continue;
+      m_sorted_pixels[next[key]++] = x+y*m_xw;
+      m_step_counts[key] += m_image.GetPixel(x, y) - m_set.bg_counts;
+    }
+}
+
+// grow annuli out from the centre for sectors s1 <= s < s2 together
+void annuli_maker::grow_annuli(int s1, int s2, std::ostream &log)
+{
+  const int no = s2-s1;
+
+  // first unbinned pixel of each sector, and the counts and number of
+  // unbinned pixels of each sector inside the radius
+  vector<int> first_pixel(no), pixels(no, 0);
+  vector<double> counts(no, 0.);
+
+  int remaining = 0;
+  for(int s=s1; s<s2; ++s) {
+    first_pixel[s-s1] = m_step_start[s*m_no_steps];
+    remaining += m_step_start[(s+1)*m_no_steps] - m_step_start[s*m_no_steps];
+  }
+
+  double last_radius = 0., inner_radius = 0.;
+  int bin_no = 0;
+  int step = 0;
+  double count = 0.;
+
+  // maximum radius (along the major axis)
+  const double maxdist = sqrt(m_xw*m_xw + m_yw*m_yw) / m_set.axis_ratio;
+
+  while( remaining > 0 ) {
+    last_radius += 0.5;
+    ++step;
+
+    if( step < m_no_steps )
+      for(int s=s1; s<s2; ++s) {
+	const int key = s*m_no_steps + step;
+	count += m_step_counts[key];
+	counts[s-s1] += m_step_counts[key];
+	pixels[s-s1] += m_step_start[key+1] - m_step_start[key];
+      }
+
+    if( count >= m_set.min_counts || last_radius > maxdist) {
+      log << "Created bin " << bin_no << " at radius "
+	  << last_radius << endl;
+
+      for(int s=s1; s<s2; ++s) {
+	const int i = s-s1;
+	const int last_pixel = first_pixel[i] + pixels[i];
+	const int binval = bin_no*m_no_sectors + s;
+	for(int j=first_pixel[i]; j<last_pixel; ++j) {
+	  const int p = m_sorted_pixels[j];
+	  m_binmap->SetPixel(p % m_xw, p / m_xw, binval);
+	}
+	first_pixel[i] = last_pixel;
+	remaining -= pixels[i];
+
+	annulus_bin bin;
+	bin.inner = inner_radius;
+	bin.outer = last_radius;
+	bin.pixels = pixels[i];
+	bin.net_counts = counts[i];
+	m_sector_bins[s].push_back(bin);
+
+	counts[i] = 0.;
+	pixels[i] = 0;
+      }
+
+      inner_radius = last_radius;
+      count = 0.;
+      ++bin_no;
+    }
+  }
+}
+
+// grow the annuli of each sector s1 <= s < s2 on its own
+void annuli_maker::grow_sectors(int s1, int s2, unsigned thread)
+{
+  for(int s=s1; s<s2; ++s) {
+    ostringstream log;
+    grow_annuli(s, s+1, log);
+    m_sector_logs[s] = log.str();
+  }
+}
+
+void annuli_maker::create_annuli(std::ostream &log)
+{
+  build_radius_index();
+  m_sector_bins.assign(m_no_sectors, vector<annulus_bin>());
+
+  if( ! m_set.indep_sectors || m_no_sectors == 1 )
+    grow_annuli(0, m_no_sectors, log);
+  else {
+    // each sector has its own annuli, which are independent of the others
+    m_sector_logs.assign(m_no_sectors, string());
+    AdaptiveBin::parallel_range(this, &annuli_maker::grow_sectors,
+				m_no_sectors, m_nothreads);
+
+    for(int s=0; s<m_no_sectors; ++s)
+      log << "Sector " << s << ":\n" << m_sector_logs[s];
+  }
+
+  // number bins by annulus then sector
+  size_t no_annuli = 0;
+  for(int s=0; s<m_no_sectors; ++s)
+    no_annuli = std::max(no_annuli, m_sector_bins[s].size());
+
+  m_bins.assign(no_annuli*m_no_sectors, annulus_bin());
+  for(int s=0; s<m_no_sectors; ++s)
+    for(size_t a=0; a<m_sector_bins[s].size(); ++a)
+      m_bins[a*m_no_sectors + s] = m_sector_bins[s][a];
+}
+
+void annuli_maker::create_fixed_annuli()
+{
+  // a pixel goes in the first annulus in the list whose radius is
+  // larger, which is the first where the running maximum is larger
+  // remaining pixels go in an extra annulus
+  const int no_listed = m_set.fixed_radii.size();
+  vector<double> max_radius_sqd(no_listed);
+  for(int i=0; i<no_listed; ++i) {
+    const double rad = m_set.fixed_radii[i];
+    max_radius_sqd[i] = rad*rad;
+    if( i > 0 && max_radius_sqd[i-1] > max_radius_sqd[i] )
+      max_radius_sqd[i] = max_radius_sqd[i-1];
+  }
+
+  m_bins.assign((no_listed+1)*m_no_sectors, annulus_bin());
+  double max_pixel_radius_sqd = 0.;
+
+  for(int y=0; y<m_yw; ++y)
+    for(int x=0; x<m_xw; ++x) {
+      // only "unset" pixels are binned
+      if( fabs(m_binmap->GetPixel(x, y) - c_notdone) >= 1e-8 )
+	continue;
+
+      const double rsqd = m_radii.radius_sqd(x, y);
+      const int annulus =
+	std::upper_bound(max_radius_sqd.begin(), max_radius_sqd.end(),
+			 rsqd) - max_radius_sqd.begin();
+      const int binno = annulus*m_no_sectors + pixel_sector(x, y);
+      m_binmap->SetPixel(x, y, binno);
+
+      annulus_bin &bin = m_bins[binno];
+      bin.pixels++;
+      bin.net_counts += m_image.GetPixel(x, y) - m_set.bg_counts;
+      if( rsqd > max_pixel_radius_sqd )
+	max_pixel_radius_sqd = rsqd;
+    }
+
+  // radii of annuli (the last extends to the furthest pixel)
+  for(int a=0; a<=no_listed; ++a)
+    for(int s=0; s<m_no_sectors; ++s) {
+      annulus_bin &bin = m_bins[a*m_no_sectors + s];
+      bin.inner = a == 0 ? 0. : sqrt(max_radius_sqd[a-1]);
+      bin.outer = sqrt( a < no_listed ? max_radius_sqd[a] :
+			std::max(max_pixel_radius_sqd, bin.inner*bin.inner) );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////
+
 class annuli_prog
 {
 public:
@@ -55,45 +407,68 @@ public:
   void run();
 
 private:
-  void load_images();
-  void write_output_image();
+  // a centre to make annuli about, and its results
+  struct centre
+  {
+    double xc, yc;
+    int x1, y1, x2, y2;        // cutout (x1 <= x < x2, y1 <= y < y2)
+    vector<int> neighbours;    // centres with overlapping cutouts
+    CFITSImage binmap;         // binmap of cutout
+    vector<annulus_bin> bins;
+    string log;
 
-  void mask_output_binmap(const CFITSImage &mask_image);
-  void create_annuli();
-  void create_fixed_annuli();
+    bool contains(int x, int y) const
+    { return x >= x1 && x < x2 && y >= y1 && y < y2; }
+  };
 
-  bool are_remaining_pixels();
+  void load_images();
+  void read_fixed_annuli();
+  void read_centres();
+  void write_output_image();
+  void write_profile();
 
-  void set_pixel_with_bin(int x, int y, int bin);
+  void mask_output_binmap(const vector<bool> &masked);
 
-  void sum_pixels_less_radius(double rad, double *counts,
-			      int *number);
-  void assign_pixels_less_radius(double rad, int bin);
+  void make_single_annuli();
+  void make_batch_annuli();
+  void make_centres(int c1, int c2, unsigned thread);
+  void make_centre(centre *cen, int index);
+  int nearest_centre(const centre &cen, int index, int x, int y) const;
 
 private:
   int m_xw, m_yw;
-  double m_min_counts;
-  int m_xc, m_yc;
-  double m_bg_counts;
+  annuli_settings m_set;
+  double m_xc, m_yc;
   string m_binmap_filename, m_input_filename;
   string m_mask_filename;
   string m_fixedann_filename;
-
-  int m_no_sectors;
-  double m_start_angle;
+  string m_centres_filename;   // catalogue of centres (optional)
+  string m_profile_filename;   // output profile table
+  double m_cutout;             // half-width of cutout around centres
+  int m_threads;               // number of threads (0 for all cpus)
 
   CFITSImage m_binmap_out;
   CFITSImage m_input_image;
   CFITSPosn m_posn;
+
+  vector<centre> m_centres;
 };
 
 annuli_prog::annuli_prog(int argc, char **argv)
-  : m_min_counts(5000.), m_xc(0), m_yc(0),
-    m_bg_counts(0.),
+  : m_xc(0), m_yc(0),
     m_binmap_filename("adannuli_binmap.fits"),
-    m_no_sectors(1),
-    m_start_angle(0.)
+    m_profile_filename("adannuli_profile.txt"),
+    m_cutout(100.),
+    m_threads(0)
 {
+  m_set.min_counts = 5000.;
+  m_set.bg_counts = 0.;
+  m_set.axis_ratio = 1.;
+  m_set.pa = 0.;
+  m_set.no_sectors = 1;
+  m_set.start_angle = 0.;
+  m_set.indep_sectors = false;
+
   parammm::param params(argc, argv);
   params.add_switch( parammm::pswitch("binmap", 'n',
 				      parammm::pstring_opt(&m_binmap_filename),
@@ -104,29 +479,65 @@ annuli_prog::annuli_prog(int argc, char **argv)
 				      "set input mask filename (optional)",
 				      "FILE"));
   params.add_switch( parammm::pswitch("background", 'b',
-				      parammm::pdouble_opt(&m_bg_counts),
+				      parammm::pdouble_opt(&m_set.bg_counts),
 				      "set bg counts/pixel (def 0)",
 				      "VAL"));
   params.add_switch( parammm::pswitch("xc", 'x',
-				      parammm::pint_opt(&m_xc),
+				      parammm::pdouble_opt(&m_xc),
 				      "set x-centre pixel ",
-				      "INT"));
+				      "VAL"));
   params.add_switch( parammm::pswitch("yc", 'y',
-				      parammm::pint_opt(&m_yc),
+				      parammm::pdouble_opt(&m_yc),
 				      "set y-centre pixel ",
-				      "INT"));
+				      "VAL"));
+  params.add_switch( parammm::pswitch("axisratio", 'q',
+				      parammm::pdouble_opt(&m_set.axis_ratio),
+				      "set minor/major axis ratio of "
+				      "elliptical annuli (def 1)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("pa", 'p',
+				      parammm::pdouble_opt(&m_set.pa),
+				      "set angle of major axis from x axis "
+				      "(def 0)",
+				      "DEG"));
   params.add_switch( parammm::pswitch("counts", 'c',
-				      parammm::pdouble_opt(&m_min_counts),
+				      parammm::pdouble_opt(&m_set.min_counts),
 				      "set minimum no counts (def 5000)",
 				      "VAL"));
   params.add_switch( parammm::pswitch("sectors", 's',
-				      parammm::pint_opt(&m_no_sectors),
+				      parammm::pint_opt(&m_set.no_sectors),
 				      "set number of sectors (def 1)",
 				      "VAL"));
   params.add_switch( parammm::pswitch("angle", 'a',
-				      parammm::pdouble_opt(&m_start_angle),
+				      parammm::pdouble_opt(&m_set.start_angle),
 				      "set sector starting angle (def 0)",
 				      "DEG"));
+  params.add_switch( parammm::pswitch("indepsectors", 'i',
+				      parammm::pbool_noopt
+				      (&m_set.indep_sectors),
+				      "grow radii of each sector separately",
+				      ""));
+  params.add_switch( parammm::pswitch("centres", 'C',
+				      parammm::pstring_opt
+				      (&m_centres_filename),
+				      "set text file listing x y of centres "
+				      "(optional)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("cutout", 'r',
+				      parammm::pdouble_opt(&m_cutout),
+				      "set half-width of cutout about each "
+				      "centre (def 100)",
+				      "PIX"));
+  params.add_switch( parammm::pswitch("profile", 'P',
+				      parammm::pstring_opt
+				      (&m_profile_filename),
+				      "set profile table out file "
+				      "(def adannuli_profile.txt)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
   params.add_switch( parammm::pswitch("fixed", 'f',
 				      parammm::pstring_opt
 				      (&m_fixedann_filename),
@@ -150,10 +561,16 @@ annuli_prog::annuli_prog(int argc, char **argv)
 
   m_input_filename = params.args()[0];
 
+  if(m_set.no_sectors < 1 || m_set.axis_ratio <= 0. ||
+     m_set.axis_ratio > 1. || m_cutout <= 0.)
+    params.show_autohelp();
+  if(m_threads <= 0)
+    m_threads = AdaptiveBin::default_threads();
+
   if(!m_fixedann_filename.empty()) {
     cout << "Reading annuli from " << m_fixedann_filename << endl;
   } else {
-    cout << "Creating annuli with a minimum of " << m_min_counts
+    cout << "Creating annuli with a minimum of " << m_set.min_counts
 	 << " counts\n";
   }
 }
@@ -166,10 +583,17 @@ void annuli_prog::run()
 {
   load_images();
   if( !m_fixedann_filename.empty())
-    create_fixed_annuli();
-  else
-    create_annuli();
+    read_fixed_annuli();
+
+  if( m_centres_filename.empty() )
+    make_single_annuli();
+  else {
+    read_centres();
+    make_batch_annuli();
+  }
+
   write_output_image();
+  write_profile();
 }
 
 void annuli_prog::load_images()
@@ -187,18 +611,73 @@ void annuli_prog::load_images()
   m_binmap_out.Resize(m_xw, m_yw);
   m_binmap_out.SetAll(c_notdone);
 
-  // load mask
-  CFITSImage mask_image;
+  // load mask and mask masked pixels
   if( ! m_mask_filename.empty() ) {
-    CFITSFile f(m_mask_filename.c_str(), CFITSFile::existingro);
-    mask_image = f.GetImage();
-  } else {
-    mask_image.Resize(m_xw, m_yw);
-    mask_image.SetAll(0.);
+    vector<bool> masked;
+    AdaptiveBin::read_mask(m_mask_filename, m_xw, m_yw, false, &masked);
+    mask_output_binmap( masked );
+  }
+}
+
+void annuli_prog::read_fixed_annuli()
+{
+  ifstream in_list(m_fixedann_filename.c_str());
+  if(!in_list) {
+    cerr << "Cannot open " << m_fixedann_filename << endl;
+    exit(1);
+  }
+
+  int bin = 0;
+  while(in_list) {
+    double rad;
+    in_list >> rad;
+    if(!in_list) continue;
+
+    cout << "Annulus " << bin << " inside " << rad << " pixels\n";
+    m_set.fixed_radii.push_back(rad);
+    ++bin;
+  }
+
+  cout << "Remaining pixels are annulus " << bin << endl;
+}
+
+// read x and y of each centre from the first two columns of a text
+// file, and find the cutouts around them
+void annuli_prog::read_centres()
+{
+  ifstream in(m_centres_filename.c_str());
+  if(!in) {
+    cerr << "Cannot open " << m_centres_filename << endl;
+    exit(1);
   }
 
-  // mask masked pixels
-  mask_output_binmap( mask_image );
+  string line;
+  while( std::getline(in, line) ) {
+    istringstream l(line);
+    centre cen;
+    if( line.empty() || line[0] == '#' || !(l >> cen.xc >> cen.yc) )
+      continue;
+
+    cen.x1 = std::max(0, int(floor(cen.xc - m_cutout)));
+    cen.y1 = std::max(0, int(floor(cen.yc - m_cutout)));
+    cen.x2 = std::min(m_xw, int(floor(cen.xc + m_cutout)) + 1);
+    cen.y2 = std::min(m_yw, int(floor(cen.yc + m_cutout)) + 1);
+    if( cen.x2 < cen.x1 ) cen.x2 = cen.x1;
+    if( cen.y2 < cen.y1 ) cen.y2 = cen.y1;
+    m_centres.push_back(cen);
+  }
+
+  // find centres whose cutouts overlap
+  const int no = m_centres.size();
+  for(int i=0; i<no; ++i)
+    for(int j=0; j<no; ++j) {
+      const centre &a = m_centres[i], &b = m_centres[j];
+      if( i != j && a.x1 < b.x2 && b.x1 < a.x2 &&
+	  a.y1 < b.y2 && b.y1 < a.y2 )
+	m_centres[i].neighbours.push_back(j);
+    }
+
+  cout << "Read " << no << " centres from " << m_centres_filename << endl;
 }
 
 void annuli_prog::write_output_image()
@@ -208,15 +687,32 @@ void annuli_prog::write_output_image()
   f.SetPosn(m_posn);
   f.WriteImage();
 
-  f.UpdateKey("RAD_XC",  CFITSFile::tint, &m_xc,
-	      "X centre pixel for radial bins");
-  f.UpdateKey("RAD_YC",  CFITSFile::tint, &m_yc,
-	      "Y centre pixel for radial bins");
-  f.UpdateKey("RAD_SEC", CFITSFile::tint, &m_no_sectors,
+  if( m_centres_filename.empty() ) {
+    f.UpdateKey("RAD_XC",  CFITSFile::tfloat, &m_xc,
+		"X centre pixel for radial bins");
+    f.UpdateKey("RAD_YC",  CFITSFile::tfloat, &m_yc,
+		"Y centre pixel for radial bins");
+  } else {
+    int no = m_centres.size();
+    f.UpdateKey("RAD_NCEN", CFITSFile::tint, &no,
+		"Number of centres for radial bins");
+    f.UpdateKey("RAD_CUT", CFITSFile::tfloat, &m_cutout,
+		"Half-width of cutout about each centre");
+  }
+  f.UpdateKey("RAD_AXR", CFITSFile::tfloat, &m_set.axis_ratio,
+	      "Minor/major axis ratio of radial bins");
+  f.UpdateKey("RAD_PA",  CFITSFile::tfloat, &m_set.pa,
+	      "Position angle of major axis of radial bins");
+  f.UpdateKey("RAD_SEC", CFITSFile::tint, &m_set.no_sectors,
 	      "Number of radial sectors");
-  f.UpdateKey("RAD_MCTS", CFITSFile::tfloat, &m_min_counts,
+  {
+    int indep = m_set.indep_sectors ? 1 : 0;
+    f.UpdateKey("RAD_INDS", CFITSFile::tint, &indep,
+		"Sectors have independent radii");
+  }
+  f.UpdateKey("RAD_MCTS", CFITSFile::tfloat, &m_set.min_counts,
 	      "Minimum number of counts in radial bins");
-  f.UpdateKey("RAD_BCTS", CFITSFile::tfloat, &m_bg_counts,
+  f.UpdateKey("RAD_BCTS", CFITSFile::tfloat, &m_set.bg_counts,
 	      "Background number of counts/pixel for radial bins");
 
   // add input file as history
@@ -226,145 +722,167 @@ void annuli_prog::write_output_image()
   f.WriteHistory(o.str().c_str());
 }
 
-void annuli_prog::mask_output_binmap(const CFITSImage &mask_image)
+// write the surface brightness profile, a line for each bin of each
+// centre, from the totals made when binning
+void annuli_prog::write_profile()
 {
-  for(int y=0; y<m_yw; ++y)
-    for(int x=0; x<m_xw; ++x) {
-      if( mask_image.GetPixel(x, y) > 0. )
-	m_binmap_out.SetPixel(x, y, c_masked);
-    }
-}
+  ofstream out(m_profile_filename.c_str());
+  if(!out) {
+    cerr << "Cannot write " << m_profile_filename << endl;
+    exit(1);
+  }
 
-bool annuli_prog::are_remaining_pixels()
-{
-  for(int y=0; y<m_yw; ++y)
-    for(int x=0; x<m_xw; ++x) {
-      if( fabs(m_binmap_out.GetPixel(x, y) - c_notdone) < 1e-8 )
-	return true;
+  out << "# counts are the total in the bin, and background is the "
+    "background per pixel times pixels\n"
+      << "# sb is (counts-background)/pixels, and sb_err is "
+    "sqrt(counts)/pixels\n"
+      << "# bins without any pixels are left out\n"
+      << "# centre xc yc bin annulus sector inner outer pixels counts "
+    "background sb sb_err\n";
+
+  int first_bin = 0;
+  for(int c=0; c<int(m_centres.size()); ++c) {
+    const centre &cen = m_centres[c];
+    for(int b=0; b<int(cen.bins.size()); ++b) {
+      const annulus_bin &bin = cen.bins[b];
+
+      // bins with no pixels are the unused annuli of sectors which
+      // grew fewer annuli than the others (--indepsectors)
+      if( bin.pixels == 0 )
+	continue;
+
+      const double bg = bin.pixels*m_set.bg_counts;
+      const double counts = bin.net_counts + bg;
+      const double sb = bin.net_counts / bin.pixels;
+      const double sb_err = sqrt( std::max(counts, 0.) ) / bin.pixels;
+
+      out << c << ' ' << cen.xc << ' ' << cen.yc << ' '
+	  << first_bin+b << ' '
+	  << b / m_set.no_sectors << ' ' << b % m_set.no_sectors << ' '
+	  << bin.inner << ' ' << bin.outer << ' '
+	  << bin.pixels << ' ' << counts << ' ' << bg << ' '
+	  << sb << ' ' << sb_err << '\n';
     }
-
-  return false;
+    first_bin += cen.bins.size();
+  }
 }
 
-void annuli_prog::sum_pixels_less_radius(double rad, double *counts,
-					 int *number)
+void annuli_prog::mask_output_binmap(const vector<bool> &masked)
 {
-  *counts = 0.;
-  *number = 0;
-
-  const double radius_sqd = rad*rad;
-
   for(int y=0; y<m_yw; ++y)
     for(int x=0; x<m_xw; ++x) {
-      const int dx = x-m_xc;
-      const int dy = y-m_yc;
-      const double curr_radius_sqd = dx*dx + dy*dy;
-      if( curr_radius_sqd < radius_sqd &&
-	  fabs(m_binmap_out.GetPixel(x, y) - c_notdone) < 1e-8 ) {
-	(*counts) += (m_input_image.GetPixel(x, y) - m_bg_counts);
-	++(*number);
-      }
+      if( masked[x+y*m_xw] )
+	m_binmap_out.SetPixel(x, y, c_masked);
     }
 }
 
-void annuli_prog::set_pixel_with_bin(int x, int y, int bin)
+void annuli_prog::make_single_annuli()
 {
-  if( fabs(m_binmap_out.GetPixel(x, y) - c_notdone) < 1e-8  ) {
-    const int dx = x-m_xc;
-    const int dy = y-m_yc;
-    const double rad_start = m_start_angle / 180. * M_PI;
-    const double rad_per_sector = (M_PI * 2.) / m_no_sectors;
-
-    // find sector
-    const double angle = atan2(double(dy), double(dx)) -
-      rad_start + M_PI;
-
-    // move sector into range 0 -> m_no_sectors-1
-    int sector = int(angle / rad_per_sector);
-    while( sector >= m_no_sectors )
-      sector -= m_no_sectors;
-    while(sector < 0)
-      sector += m_no_sectors;
-
-    m_binmap_out.SetPixel(x, y, bin*m_no_sectors + sector);
-  }
+  annuli_maker maker(m_set, m_input_image, &m_binmap_out, m_xc, m_yc,
+		     m_threads);
+  maker.create(cout);
+
+  // keep the bins for the profile
+  centre cen;
+  cen.xc = m_xc;
+  cen.yc = m_yc;
+  cen.x1 = cen.y1 = 0;
+  cen.x2 = m_xw;
+  cen.y2 = m_yw;
+  cen.bins = maker.bins();
+  m_centres.push_back(cen);
 }
 
-void annuli_prog::assign_pixels_less_radius(double rad, int bin)
+// index of the centre a pixel in the cutout of centre index belongs
+// to: the nearest centre whose cutout contains it
+int annuli_prog::nearest_centre(const centre &cen, int index,
+				int x, int y) const
 {
-  const double radius_sqd = rad*rad;
-
-  for(int y=0; y<m_yw; ++y)
-    for(int x=0; x<m_xw; ++x) {
-      const int dx = x-m_xc;
-      const int dy = y-m_yc;
-      const double curr_radius_sqd = dx*dx + dy*dy;
-      if( curr_radius_sqd < radius_sqd )
-	set_pixel_with_bin(x, y, bin);
+  int best = index;
+  double best_dist = (x-cen.xc)*(x-cen.xc) + (y-cen.yc)*(y-cen.yc);
+
+  for(size_t i=0; i<cen.neighbours.size(); ++i) {
+    const int n = cen.neighbours[i];
+    const centre &other = m_centres[n];
+    if( ! other.contains(x, y) )
+      continue;
+
+    const double dist = (x-other.xc)*(x-other.xc) +
+      (y-other.yc)*(y-other.yc);
+    if( dist < best_dist || (dist == best_dist && n < best) ) {
+      best = n;
+      best_dist = dist;
     }
+  }
+
+  return best;
 }
 
-void annuli_prog::create_annuli()
+// make the annuli in the cutout of a centre
+void annuli_prog::make_centre(centre *cen, int index)
 {
-  double last_radius = 0.;
-  int bin_no = 0;
-
-  // maximum radius
-  const double maxdist = sqrt(m_xw*m_xw + m_yw*m_yw);
-
-  while( are_remaining_pixels() ) {
-    last_radius += 0.5;
-
-    double count;
-    int pixels;
+  const int cxw = cen->x2 - cen->x1, cyw = cen->y2 - cen->y1;
+  if( cxw == 0 || cyw == 0 ) {
+    cen->log = "Centre outside image\n";
+    return;
+  }
 
-    sum_pixels_less_radius(last_radius, &count, &pixels);
-    if( count >= m_min_counts || last_radius > maxdist) {
-      cout << "Created bin " << bin_no << " at radius "
-	   << last_radius << endl;
-      assign_pixels_less_radius(last_radius, bin_no);
-      ++bin_no;
+  // copy cutout, only binning pixels which belong to this centre
+  CFITSImage image(cxw, cyw);
+  cen->binmap.Resize(cxw, cyw);
+  for(int y=cen->y1; y<cen->y2; ++y)
+    for(int x=cen->x1; x<cen->x2; ++x) {
+      image.SetPixel(x-cen->x1, y-cen->y1, m_input_image.GetPixel(x, y));
+
+      const bool mine =
+	fabs(m_binmap_out.GetPixel(x, y) - c_notdone) < 1e-8 &&
+	nearest_centre(*cen, index, x, y) == index;
+      cen->binmap.SetPixel(x-cen->x1, y-cen->y1,
+			   mine ? c_notdone : c_masked);
     }
-  }
 
-  // finished
+  ostringstream log;
+  annuli_maker maker(m_set, image, &cen->binmap,
+		     cen->xc - cen->x1, cen->yc - cen->y1, 1);
+  maker.create(log);
+  cen->bins = maker.bins();
+  cen->log = log.str();
 }
 
-void annuli_prog::create_fixed_annuli()
+void annuli_prog::make_centres(int c1, int c2, unsigned thread)
 {
-  ifstream in_list(m_fixedann_filename.c_str());
-  if(!in_list) {
-    cerr << "Cannot open " << m_fixedann_filename << endl;
-    exit(1);
-  }
-
-  int bin = 0;
-  while(in_list) {
-    double rad;
-    in_list >> rad;
-    if(!in_list) continue;
+  for(int c=c1; c<c2; ++c)
+    make_centre(&m_centres[c], c);
+}
 
-    cout << "Annulus " << bin << " inside " << rad << " pixels\n";
-    const double rad_sqd = rad*rad;
-
-    for(int y=0; y<m_yw; ++y)
-      for(int x=0; x<m_xw; ++x) {
-	const int dx = x-m_xc;
-	const int dy = y-m_yc;
-	const double curr_radius_sqd = dx*dx + dy*dy;
-	if(curr_radius_sqd < rad_sqd)
-	  set_pixel_with_bin(x, y, bin);
-    }
+// make annuli about each centre in parallel, then copy them into the
+// output binmap, numbering the bins of each centre after the last
+void annuli_prog::make_batch_annuli()
+{
+  AdaptiveBin::parallel_range(this, &annuli_prog::make_centres,
+			      m_centres.size(), m_threads);
+
+  int first_bin = 0;
+  for(int c=0; c<int(m_centres.size()); ++c) {
+    const centre &cen = m_centres[c];
+    cout << "Centre " << c << " (" << cen.xc << ", " << cen.yc
+	 << "), first bin " << first_bin << ":\n" << cen.log;
+
+    for(int y=cen.y1; y<cen.y2; ++y)
+      for(int x=cen.x1; x<cen.x2; ++x) {
+	const double bin = cen.binmap.GetPixel(x-cen.x1, y-cen.y1);
+	if( bin >= 0. )
+	  m_binmap_out.SetPixel(x, y, bin + first_bin);
+      }
 
-    ++bin;
+    first_bin += cen.bins.size();
   }
 
-  cout << "Remaining pixels are annulus " << bin << endl;
+  // pixels outside every cutout are not binned
   for(int y=0; y<m_yw; ++y)
-    for(int x=0; x<m_xw; ++x) {
-      // function only sets "unset" pixels
-      set_pixel_with_bin(x, y, bin);
-    }
+    for(int x=0; x<m_xw; ++x)
+      if( fabs(m_binmap_out.GetPixel(x, y) - c_notdone) < 1e-8 )
+	m_binmap_out.SetPixel(x, y, c_masked);
 }
 
 ////////////////////////////////////////////////////////////////////////
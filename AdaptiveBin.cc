@@ -29,11 +29,13 @@
 #include <vector>
 #include <sstream>
 #include <cassert>
+#include <cmath>
 
 #include <parammm/parammm.hh>
 #include <FITSFile.h>
 
 #include "binmodule.hh"
+#include "maskimage.hh"
 #include "version.hh"
 
 using std::string;
@@ -44,6 +46,8 @@ using std::cerr;
 using std::clog;
 using std::endl;
 using std::ostringstream;
+using std::sqrt;
+using std::ceil;
 
 namespace AdaptiveBin {
 
@@ -91,13 +95,20 @@ namespace AdaptiveBin {
 	     CFITSImage *error_image,
 	     CFITSImage *binmap_image);
 
-    void set_mask_image(const CFITSImage &mask,
-			bool invert_mask = false);
+    void set_mask(const vector<bool> &masked);
+    // pixels set in masked (one per pixel, row by row) are not binned
+
+    void set_hexagons(double factor);
+    // bin with hexagons, growing in size by factor each pass
 
   private:
     //    void binpass(int pixsize, bool finalpass);
     void apply_mask();
     void pass_bins_and_sort(int pixsize, bool finalpass);
+    void pass_hexagons_and_sort(double size, bool finalpass);
+    int hexagon_row_span(double cx, double cy, double size, int y,
+			 int *x1, int *x2) const;
+    void sort_and_paint_bins(binval_list *binslist);
     void check_noncontiguous_bin(const pixlist &binpixels,
 				 bool finalpass,
 				 binval_list *binlist);
@@ -108,11 +119,12 @@ namespace AdaptiveBin {
     double m_threshold;                      // threshold error value
     int m_subbinposn;                        // sub-bin positioning value
     bool m_contig_check;                     // only allow contig regions
+    double m_hexfactor;                      // hexagon growth (0 for squares)
     binmodule *m_binmod;                     // module to do the binning
     CFITSImage m_out_image;                  // output binned image
     CFITSImage m_error_image;                // output error image
     CFITSImage m_output_binmap_image;        // output binmap
-    CFITSImage m_mask_image;                 // mask to use in binning
+    vector<bool> m_masked;                   // pixels not to bin
   };
 
   binner::binner(binmodule *bm, double threshold, int subpixposn,
@@ -120,11 +132,12 @@ namespace AdaptiveBin {
     : m_threshold(threshold),
       m_subbinposn(subpixposn),
       m_contig_check(contig_check),
+      m_hexfactor(0.),
       m_binmod(bm),
       m_out_image(bm->xw(), bm->yw()),
       m_error_image(bm->xw(), bm->yw()),
       m_output_binmap_image(bm->xw(), bm->yw()),
-      m_mask_image(bm->xw(), bm->yw())
+      m_masked(bm->xw()*bm->yw(), false)
   {
   }
 
@@ -132,29 +145,18 @@ namespace AdaptiveBin {
   {
   }
 
-  void binner::set_mask_image(const CFITSImage &mask, bool invert_mask)
+  void binner::set_mask(const vector<bool> &masked)
   {
     // check mask is the same size as the image
-    assert( mask.GetXW() == m_mask_image.GetXW() &&
-	    mask.GetYW() == m_mask_image.GetYW() );
+    assert( masked.size() == m_masked.size() );
 
-    m_mask_image = mask;
+    m_masked = masked;
+  }
 
-    if(invert_mask)
-      {
-	const unsigned xw = mask.GetXW(), yw = mask.GetYW();
-
-	for(unsigned y=0; y<yw; ++y)
-	  for(unsigned x=0; x<xw; ++x)
-	    {
-	      double v = m_mask_image.GetPixel(x, y);
-	      if( v < 1e-10 )
-		v = 1;
-	      else
-		v = 0;
-	      m_mask_image.SetPixel(x, y, v);
-	    }
-      }
+  void binner::set_hexagons(double factor)
+  {
+    assert( factor > 1. );
+    m_hexfactor = factor;
   }
 
   void binner::bin(CFITSImage *out_image,
@@ -168,13 +170,28 @@ namespace AdaptiveBin {
     m_latest_bin_no = 0;
     apply_mask();
 
-    // do passes over factor of 2
-    int pass;
-    for(pass=1; pass<m_binmod->xw() || pass<m_binmod->yw(); pass *= 2)
-      pass_bins_and_sort(pass, false);
+    if( m_hexfactor > 1. )
+      {
+	// start with hexagons of the area of a pixel, stopping when a
+	// hexagon is the size of the image
+	const double maxsize = std::max(m_binmod->xw(), m_binmod->yw());
+	double size;
+	for(size = sqrt(2./(3.*sqrt(3.))); size < maxsize;
+	    size *= m_hexfactor)
+	  pass_hexagons_and_sort(size, false);
+
+	pass_hexagons_and_sort(size, true);
+      }
+    else
+      {
+	// do passes over factor of 2
+	int pass;
+	for(pass=1; pass<m_binmod->xw() || pass<m_binmod->yw(); pass *= 2)
+	  pass_bins_and_sort(pass, false);
 
-    // final pass
-    pass_bins_and_sort(pass, true);
+	// final pass
+	pass_bins_and_sort(pass, true);
+      }
 
     // return values
     *out_image = m_out_image;
@@ -184,10 +201,11 @@ namespace AdaptiveBin {
 
   void binner::apply_mask()
   {
+    const int xw = m_binmod->xw();
     for(int y = 0; y < m_binmod->yw(); ++y)
-      for(int x = 0; x < m_binmod->xw(); ++x)
+      for(int x = 0; x < xw; ++x)
 	{
-	  if( m_mask_image.GetPixel(x, y) > 0. )
+	  if( m_masked[x+y*xw] )
 	    m_output_binmap_image.SetPixel(x, y, -1.);
 	}
   }
@@ -345,6 +363,14 @@ namespace AdaptiveBin {
     
       } // pixels
 
+    sort_and_paint_bins(&binslist);
+
+  } // fn
+
+  void binner::sort_and_paint_bins(binval_list *binlist)
+  {
+    binval_list &binslist = *binlist;
+
     // sort bins into error order
     // (not needed unless subbinning on)
     if(m_subbinposn != 1)
@@ -376,7 +402,95 @@ namespace AdaptiveBin {
       m_latest_bin_no ++;
     }
 
-  } // fn
+  }
+
+  int binner::hexagon_row_span(double cx, double cy, double size, int y,
+			       int *x1, int *x2) const
+  {
+    // pixels x1<=x<x2 in row y have their centres inside the hexagon
+    // (pointy-topped with circumradius size) centred on cx, cy
+    // edges are half-open, so neighbouring hexagons don't overlap
+
+    const double dy = std::fabs(y + 0.5 - cy);
+    if( dy >= size )
+      return 0;
+
+    const double halfwidth = std::min( sqrt(3.)*0.5*size,
+				       sqrt(3.)*(size-dy) );
+    *x1 = std::max( int(ceil(cx - halfwidth - 0.5)), 0 );
+    *x2 = std::min( int(ceil(cx + halfwidth - 0.5)), m_binmod->xw() );
+    return std::max(*x2 - *x1, 0);
+  }
+
+  // hexagonal version of pass_bins_and_sort
+  // the pixels in each hexagon are totalled a row at a time from
+  // a table of row totals, and only listed if the hexagon is good enough
+  void binner::pass_hexagons_and_sort(double size, bool finalpass)
+  {
+    cout << "Pass " << size << " (hexagons)" << endl;
+
+    const binrowtable rows(m_binmod, m_output_binmap_image);
+    const int xw = m_binmod->xw(), yw = m_binmod->yw();
+
+    // lattice spacing across and between rows
+    const double dx = sqrt(3.)*size;
+    const double dy = 1.5*size;
+
+    binval_list binslist;
+    binsums sums = m_binmod->newsums();
+
+    // the lattice is offset by fractions of its spacing to allow bins
+    // to start in different places
+    const int ns = m_subbinposn;
+    for(int oy=0; oy<ns; ++oy)
+      for(int ox=0; ox<ns; ++ox)
+	{
+	  const double offx = dx*ox/ns, offy = dy*oy/ns;
+	  const int norows = int(ceil( (yw+size-offy)/dy )) + 1;
+	  const int nocols = int(ceil( (xw+dx-offx)/dx )) + 1;
+
+	  for(int r=-1; r<norows; ++r)
+	    for(int c=-1; c<nocols; ++c)
+	      {
+		const double cy = offy + r*dy;
+		const double cx = offx + (c + ((r & 1) ? 0.5 : 0.))*dx;
+
+		const int y1 = std::max( int(ceil(cy-size-0.5)), 0 );
+		const int y2 = std::min( int(ceil(cy+size-0.5)), yw );
+
+		// total up the rows of the hexagon
+		sums.clear();
+		int x1, x2;
+		for(int y=y1; y<y2; ++y)
+		  if( hexagon_row_span(cx, cy, size, y, &x1, &x2) > 0 )
+		    rows.addspan(y, x1, x2, &sums);
+
+		if( sums.m_npix == 0 )
+		  continue;
+
+		const double error = m_binmod -> fracerror(sums, true);
+		if( ! (error <= m_threshold || finalpass) )
+		  continue;
+
+		// list the pixels left to bin
+		pixlist pixels;
+		for(int y=y1; y<y2; ++y)
+		  if( hexagon_row_span(cx, cy, size, y, &x1, &x2) > 0 )
+		    for(int x=x1; x<x2; ++x)
+		      if( m_output_binmap_image.GetPixel(x, y) < -1. )
+			pixels.push_back( pixel(x, y) );
+
+		if(m_contig_check) {
+		  check_noncontiguous_bin(pixels, finalpass, &binslist);
+		} else {
+		  binval p(pixels, error);
+		  binslist.push_back(p);
+		}
+	      }
+	}
+
+    sort_and_paint_bins(&binslist);
+  }
 
 } // namespace
 
@@ -403,6 +517,8 @@ public:
   string m_mask_fname;   // filename of the mask to use (optional)
   string m_value;        // quantity to bin
   int m_sub_bin;         // sub-binning value
+  double m_hexfactor;    // hexagon size factor between passes
+  bool m_hex;            // bin with hexagons
   bool m_contig;         // only allow contiguous regions
   bool m_verbose;        // display verbose information
   bool m_invert_mask;    // invert 0 and 1 in mask
@@ -418,6 +534,8 @@ prog::prog(int argc, char **argv)
     m_binmap_fname("adbin_binmap.fits"),
     m_value("count(0)"),
     m_sub_bin(1),
+    m_hexfactor(2.),
+    m_hex(false),
     m_contig(false),
     m_verbose(false),
     m_invert_mask(false)
@@ -456,6 +574,14 @@ prog::prog(int argc, char **argv)
 				      "set subpixel positioning "
 				      "divisior (def. 1)",
 				      "INT"));
+  params.add_switch( parammm::pswitch("hex", 0,
+				      parammm::pbool_noopt(&m_hex),
+				      "bin with hexagons instead of squares",
+				      ""));
+  params.add_switch( parammm::pswitch("hexfactor", 0,
+				      parammm::pdouble_opt(&m_hexfactor),
+				      "set hexagon growth factor between "
+				      "passes (def 2)", "VAL"));
   params.add_switch( parammm::pswitch("contig", 'c',
 				      parammm::pbool_noopt(&m_contig),
 				      "only allow contiguous regions",
@@ -482,7 +608,7 @@ prog::prog(int argc, char **argv)
 
   params.interpret_and_catch();
 
-  if(params.args().size() < 1)
+  if(params.args().size() < 1 || m_hexfactor <= 1.)
     params.show_autohelp();
 
   try {
@@ -525,6 +651,7 @@ prog::prog(int argc, char **argv)
     m_history_list.push_back( string("mask: ") + m_mask_fname );
     m_history_list.push_back( string("value: ") + m_binmod->get_value_descr() );
     m_history_list.push_back( string("contig: ") + (m_contig ? "true" : "false") );
+    m_history_list.push_back( string("hex: ") + (m_hex ? "true" : "false") );
     
     {
       ostringstream o;
@@ -535,6 +662,11 @@ prog::prog(int argc, char **argv)
       o << "subpix: " << m_sub_bin << '\0';
       m_history_list.push_back( o.str() );
     }
+    if(m_hex) {
+      ostringstream o;
+      o << "hexfactor: " << m_hexfactor << '\0';
+      m_history_list.push_back( o.str() );
+    }
   } // end history comments
 
   // write history to screen if verbose option is on
@@ -567,10 +699,14 @@ void prog::run()
   CFITSImage out, err, pixel;
   AdaptiveBin::binner b(m_binmod, m_threshold, m_sub_bin,
 			m_contig);
+  if(m_hex)
+    b.set_hexagons(m_hexfactor);
 
   if( ! m_mask_fname.empty() ) {
-    CFITSFile mask_file(m_mask_fname.c_str(), CFITSFile::existingro);
-    b.set_mask_image(mask_file.GetImage(), m_invert_mask);
+    vector<bool> masked;
+    AdaptiveBin::read_mask(m_mask_fname, m_binmod->xw(), m_binmod->yw(),
+			   m_invert_mask, &masked);
+    b.set_mask(masked);
   }
 
   b.bin(&out, &err, &pixel);
@@ -33,6 +33,8 @@
 #include <FITSFile.h>
 
 #include "binmodule.hh"
+#include "maskimage.hh"
+#include "binshapes.hh"
 #include "version.hh"
 
 using std::string;
@@ -80,11 +82,13 @@ namespace AdaptiveBin {
   {
   public:
     binner(binmodule *bm, double threshold,
-	   int subpixposn, bool contig_check);
+	   int subpixposn, bool contig_check,
+	   const shape_registry *shapes);
     // bm is binning module (by which mode we're binning)
     // threshold is fractional error threshold
     // subpixposn is number of subbins/bin
     // if contig_check is true, then we only bin 'contiguous' regions
+    // shapes are the shapes to try as well as squares
 
     ~binner();
 
@@ -92,8 +96,8 @@ namespace AdaptiveBin {
 	     CFITSImage *error_image,
 	     CFITSImage *binmap_image);
 
-    void set_mask_image(const CFITSImage &mask,
-			bool invert_mask = false);
+    void set_mask(const vector<bool> &masked);
+    // pixels set in masked (one per pixel, row by row) are not binned
 
   private:
     void apply_mask();
@@ -102,31 +106,34 @@ namespace AdaptiveBin {
 				 bool finalpass,
 				 binval_list *binlist);
     void sort_and_paint_bins(binval_list *bins);
-    void pass_bins_and_sort_triangle(int size);
+    void pass_bins_and_sort_shapes(int size);
   private:
     int m_latest_bin_no;                     // keep a count of the outputted bins
 
     double m_threshold;                      // threshold error value
     int m_subbinposn;                        // sub-bin positioning value
     bool m_contig_check;                     // only allow contig regions
+    const shape_registry *m_shapes;          // shapes to try
     binmodule *m_binmod;                     // module to do the binning
     CFITSImage m_out_image;                  // output binned image
     CFITSImage m_error_image;                // output error image
     CFITSImage m_output_binmap_image;        // output binmap
-    CFITSImage m_mask_image;                 // mask to use in binning
+    vector<bool> m_masked;                   // pixels not to bin
   };
 }
 
 AdaptiveBin::binner::binner(binmodule *bm, double threshold, int subpixposn,
-			    bool contig_check)
+			    bool contig_check,
+			    const shape_registry *shapes)
   : m_threshold(threshold),
     m_subbinposn(subpixposn),
     m_contig_check(contig_check),
+    m_shapes(shapes),
     m_binmod(bm),
     m_out_image(bm->xw(), bm->yw()),
     m_error_image(bm->xw(), bm->yw()),
     m_output_binmap_image(bm->xw(), bm->yw()),
-    m_mask_image(bm->xw(), bm->yw())
+    m_masked(bm->xw()*bm->yw(), false)
 {
 }
 
@@ -134,31 +141,12 @@ AdaptiveBin::binner::~binner()
 {
 }
 
-void AdaptiveBin::binner::set_mask_image(const CFITSImage &mask,
-					 bool invert_mask)
+void AdaptiveBin::binner::set_mask(const vector<bool> &masked)
 {
   // check mask is the same size as the image
-  assert( mask.GetXW() == m_mask_image.GetXW() &&
-	  mask.GetYW() == m_mask_image.GetYW() );
+  assert( masked.size() == m_masked.size() );
 
-  m_mask_image = mask;
-
-  if(invert_mask)
-    {
-      const unsigned xw = mask.GetXW(), yw = mask.GetYW();
-      
-      for(unsigned y=0; y<yw; ++y)
-	for(unsigned x=0; x<xw; ++x)
-	  {
-	    double v = m_mask_image.GetPixel(x, y);
-	    if( v < 1e-10 )
-	      v = 1;
-	    else
-	      v = 0;
-	    m_mask_image.SetPixel(x, y, v);
-	  }
-    }
-  
+  m_masked = masked;
 }
 
 void AdaptiveBin::binner::bin(CFITSImage *out_image,
@@ -175,12 +163,14 @@ void AdaptiveBin::binner::bin(CFITSImage *out_image,
   // do passes over factor of 2
   int pass;
   for(pass=1; pass<m_binmod->xw() || pass<m_binmod->yw(); pass *= 2) {
-    if(pass > 2) pass_bins_and_sort_triangle(pass);
+    if(pass > 2 && m_shapes->any_stencils())
+      pass_bins_and_sort_shapes(pass);
 
-    pass_bins_and_sort(pass, false);
+    if(m_shapes->selected("square"))
+      pass_bins_and_sort(pass, false);
   }
 
-  // final pass
+  // final pass (always squares, so everything is binned)
   pass_bins_and_sort(pass, true);
 
   // return values
@@ -191,9 +181,10 @@ void AdaptiveBin::binner::bin(CFITSImage *out_image,
 
 void AdaptiveBin::binner::apply_mask()
 {
+  const int xw = m_binmod->xw();
   for(int y = 0; y < m_binmod->yw(); ++y)
-    for(int x = 0; x < m_binmod->xw(); ++x) {
-      if( m_mask_image.GetPixel(x, y) > 0. )
+    for(int x = 0; x < xw; ++x) {
+      if( m_masked[x+y*xw] )
 	m_output_binmap_image.SetPixel(x, y, -1.);
     }
 
@@ -260,70 +251,71 @@ void AdaptiveBin::binner::pass_bins_and_sort(int size, bool finalpass)
   sort_and_paint_bins(&binslist);
 }
 
-// experimental triangle version of bins
-void AdaptiveBin::binner::pass_bins_and_sort_triangle(int size)
+// experimental version of bins trying other shapes
+// every stencil is a span of each row of the tile, so the totals of the
+// stencils are found from a table of row totals, and pixels are only
+// listed for stencils which reach the threshold
+void AdaptiveBin::binner::pass_bins_and_sort_shapes(int size)
 {
   binval_list binslist;
 
   cout << "Pass (T) " << size << endl;
 
-  const int nx = m_binmod->xw() / size + 1;
-  const int ny = m_binmod->yw() / size + 1;
+  const int xw = m_binmod->xw(), yw = m_binmod->yw();
+  const int nx = xw / size + 1;
+  const int ny = yw / size + 1;
+
+  const binrowtable rows(m_binmod, m_output_binmap_image);
+
+  stencil_list stencils;
+  m_shapes->make_stencils(size, &stencils);
+  const int no_stencils = stencils.size();
+
+  binsums sums = m_binmod->newsums();
 
   // make an array of bins with error less than threshold
   // iterate over subbins
   for(int x=0; x<nx; x++)
     for(int y=0; y<ny; y++) {
-	  
-      // make bin with size size x size
-      pixlist pixels[12];
+      const int x0 = x*size, y0 = y*size;
 
-      for(int sx=0; sx < size; sx++)
-	for(int sy=0; sy < size; sy++) {
-	  const int tx = x*size+sx;
-	  const int ty = y*size+sy;
-	  if(tx < m_binmod->xw() && ty < m_binmod->yw() )
-	    if( m_output_binmap_image.GetPixel(tx, ty) < -1. ) {
-	      const int no_types = 6;
-	      int nos[no_types];
-	      nos[0] = ( sx <= sy ) ? 0 : 1;           // triangular bin
-	      nos[1] = ( sx >= size-sy ) ? 2 : 3;      // triangle (other dirn)
-	      nos[2] = ( sx < size/2 ) ? 4 : 5;       // half-square rect
-	      nos[3] = ( sy < size/2 ) ? 6 : 7;       // half-square rect
-
-	      // bug fix below
-	      // this is an equivalent 1-pixel out triangle
-	      nos[4] = ( sx <= sy-1 ) ? 8 : 9;
-	      nos[5] = ( sx >= size-sy-1 ) ? 10 : 11;
-
-	      const pixel pix(tx, ty);
-	      for(int i=0; i<no_types; ++i)
-		pixels[ nos[i] ].push_back(pix);
-	    }
-	}
-      // end bin
+      for(int i=0; i<no_stencils; i++) {
+	const stencil &st = stencils[i];
+
+	sums.clear();
+	for(int sy=0; sy<size && y0+sy<yw; ++sy)
+	  if( st.lo[sy] < st.hi[sy] )
+	    rows.addspan(y0+sy, x0+st.lo[sy], x0+st.hi[sy], &sums);
 
-      for(int i=0; i<12; i++) {
 	// are there any pixels in bin?
-	if( pixels[i].size() > 0 ) {
-	  // is binning error < threshold
-	  const double error = m_binmod -> fracerror(pixels[i], true);
-	  if(error <= m_threshold) {
-	    
-	    // if we need pixels to be contiguous, check for it
-	    // otherwise just do it
-	    if(m_contig_check) {
-	      check_noncontiguous_bin(pixels[i], false,
-				      &binslist);
-	    } else {
-	      binval p(pixels[i], error);
-	      binslist.push_back(p);
-	    }
-	    
+	if( sums.m_npix == 0 )
+	  continue;
+
+	// is binning error < threshold
+	const double error = m_binmod -> fracerror(sums, true);
+	if( ! (error <= m_threshold) )
+	  continue;
+
+	pixlist pixels;
+	for(int sx=0; sx < size; sx++)
+	  for(int sy=0; sy < size; sy++) {
+	    const int tx = x0+sx, ty = y0+sy;
+	    if(tx < xw && ty < yw && st.contains(sx, sy))
+	      if( m_output_binmap_image.GetPixel(tx, ty) < -1. )
+		pixels.push_back( pixel(tx, ty) );
 	  }
+
+	// if we need pixels to be contiguous, check for it
+	// otherwise just do it
+	if(m_contig_check) {
+	  check_noncontiguous_bin(pixels, false,
+				  &binslist);
+	} else {
+	  binval p(pixels, error);
+	  binslist.push_back(p);
 	}
       } // loop over i
-    
+
     } // pixels
 
   sort_and_paint_bins(&binslist);
@@ -478,11 +470,14 @@ public:
   string m_binmap_fname; // output binmap filename
   string m_mask_fname;   // filename of the mask to use (optional)
   string m_value;        // quantity to bin
+  string m_shape_names;  // shapes to bin with
   int m_sub_bin;         // sub-binning value
   bool m_contig;         // only allow contiguous regions
   bool m_verbose;        // display verbose information
   bool m_invert_mask;    // invert 0 and 1 in mask
 
+  AdaptiveBin::shape_registry m_shapes;
+
   vector<string> m_history_list;
 };
 
@@ -493,9 +488,11 @@ prog::prog(int argc, char **argv)
     m_err_fname("adbin_err.fits"),
     m_binmap_fname("adbin_binmap.fits"),
     m_value("count(0)"),
+    m_shape_names("square,triangle,halfsquare"),
     m_sub_bin(1),
     m_contig(false),
-    m_verbose(false)
+    m_verbose(false),
+    m_invert_mask(false)
 {
   parammm::param params(argc, argv);
   params.add_switch( parammm::pswitch("out", 'o',
@@ -531,6 +528,10 @@ prog::prog(int argc, char **argv)
 				      "set subpixel positioning "
 				      "divisior (def. 1)",
 				      "INT"));
+  params.add_switch( parammm::pswitch("shapes", 'S',
+				      parammm::pstring_opt(&m_shape_names),
+				      "set shapes to try (def square,"
+				      "triangle,halfsquare)", "LIST"));
   params.add_switch( parammm::pswitch("contig", 'c',
 				      parammm::pbool_noopt(&m_contig),
 				      "only allow contiguous regions",
@@ -560,6 +561,12 @@ prog::prog(int argc, char **argv)
   if(params.args().size() < 1)
     params.show_autohelp();
 
+  if( ! m_shapes.select(m_shape_names) ) {
+    clog << "Invalid shapes (choose from " << m_shapes.names()
+	 << ")\n\n";
+    params.show_autohelp();
+  }
+
   try {
     m_binmod = new AdaptiveBin::ratio_binmodule(params.args());
     m_binmod->selectvalue(m_value);
@@ -595,6 +602,7 @@ prog::prog(int argc, char **argv)
     m_history_list.push_back( string("mask: ") + m_mask_fname );
     m_history_list.push_back( string("value: ") + m_binmod->get_value_descr() );
     m_history_list.push_back( string("contig: ") + (m_contig ? "true" : "false") );
+    m_history_list.push_back( string("shapes: ") + m_shape_names );
     
     {
       ostringstream o;
@@ -636,11 +644,13 @@ void prog::run()
 {
   CFITSImage out, err, pixel;
   AdaptiveBin::binner b(m_binmod, m_threshold, m_sub_bin,
-			m_contig);
+			m_contig, &m_shapes);
 
   if( ! m_mask_fname.empty() ) {
-    CFITSFile mask_file(m_mask_fname.c_str(), CFITSFile::existingro);
-    b.set_mask_image(mask_file.GetImage(), m_invert_mask);
+    vector<bool> masked;
+    AdaptiveBin::read_mask(m_mask_fname, m_binmod->xw(), m_binmod->yw(),
+			   m_invert_mask, &masked);
+    b.set_mask(masked);
   }
 
   b.bin(&out, &err, &pixel);
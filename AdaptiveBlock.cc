@@ -2,31 +2,70 @@
 // Jeremy Sanders 2000
 
 // Idea:
-//  Make image a power of two
 //  Those pixels > sig/noise, keep
 //  Otherwise bin 2x2, repeat, 4x4, etc...
+//  until a single block covers the image
 
 #include <algorithm>
 #include <cstdlib>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <list>
+#include <queue>
+#include <vector>
 #include <string>
-#include <strstream>
+#include <sstream>
 #include <fstream>
-#include "../FITSImage.h"
-#include "../FITSFile.h"
+#include <FITSImage.h>
+#include <FITSFile.h>
 #include "Coord.hh"
 #include "SigCalc.hh"
+#include "parallel.hh"
+
+using std::string;
+using std::cout;
+using std::clog;
+using std::endl;
+using std::istringstream;
 
 namespace AdaptiveBin {
 
   const string progVersion = "0.2.2";
   const string progDate = __DATE__ ", " __TIME__;
 
+  // candidate block for the move-block algorithm, with top-left corner
+  // m_x, m_y. The queue gives the lowest error first, and for equal
+  // errors the largest m_x then m_y, which is the block the full
+  // scan used to pick
+  class CBlockCandidate {
+  public:
+    CBlockCandidate(double err, int x, int y, unsigned stamp)
+      : m_err(err), m_x(x), m_y(y), m_stamp(stamp) {}
+    bool operator<(const CBlockCandidate &other) const {
+      if( m_err != other.m_err ) return m_err > other.m_err;
+      if( m_x != other.m_x ) return m_x < other.m_x;
+      return m_y < other.m_y;
+    }
+
+    double m_err;
+    int m_x, m_y;
+    unsigned m_stamp;   // which version of the block totals this is
+  };
+
+  // result of evaluating a block in a gridded pass
+  class CBlockResult {
+  public:
+    CBlockResult() : m_binned(false), m_value(0.), m_error(0.) {}
+
+    bool m_binned;
+    double m_value, m_error;
+  };
+
   class CBlocker {
   public: // public interface
-    CBlocker(CSigCalc *sigcalc, bool alternatealgoritm=false);
+    CBlocker(CSigCalc *sigcalc, bool alternatealgoritm=false,
+	     unsigned nothreads=1);
     ~CBlocker();
     void Block(double fracterr, int ivalue,
 	       CFITSImage *outImage, CFITSImage *errImage,
@@ -34,13 +73,22 @@ namespace AdaptiveBin {
 
   private: // private methods
     void binPass(int factor, int ivalue);          // actual algorithm
+    void evaluateColumns(int x1, int x2, unsigned thread);
     void binPassMoveBlock(int factor, int ivalue); // alternative algorithm
+    void paintBin(const CSigCalc::cSpanList &spans,
+		  double value, double error);     // output and mask a bin
 
   private: // private data
     CSigCalc *m_sigcalc;
     double m_fracterr;
-    int m_side;
+    int m_side;           // smallest power of two covering the image
     const int m_realxw, m_realyw;
+    unsigned m_nothreads;
+
+    // state of the current gridded pass
+    int m_passfactor, m_passvalue, m_passcols, m_passrows;
+    bool m_finalpass;
+    std::vector<CBlockResult> m_results;  // for each block, x*rows+y
 
     CFITSImage *m_outImage;
     CFITSImage *m_errImage;
@@ -59,23 +107,21 @@ using std::sqrt;
 
 //////////////////////////////////////////////////////////////
 
-CBlocker::CBlocker(CSigCalc *sigcalc, bool alternatealgorithm) :
+CBlocker::CBlocker(CSigCalc *sigcalc, bool alternatealgorithm,
+		   unsigned nothreads) :
   m_sigcalc( sigcalc ),
   m_realxw( m_sigcalc->GetXW() ),
   m_realyw( m_sigcalc->GetYW() ),
+  m_nothreads( nothreads ),
   m_useAlternateAlgorithm(alternatealgorithm)
 {
   m_fracterr = 0.0;
 
-  // find largest power of two for edge
-  int xw = 1;
-  while( xw < m_realxw )
-    xw *= 2;
-  int yw = 1;
-  while( yw < m_realyw )
-    yw *= 2;
-
-  m_side = std::max(xw, yw);
+  // the block size doubles each pass until one block covers the
+  // image, which is the final pass
+  m_side = 1;
+  while( m_side < std::max(m_realxw, m_realyw) )
+    m_side *= 2;
 
   // allocate output space
   m_outImage = new CFITSImage(m_realxw, m_realyw);
@@ -92,118 +138,230 @@ CBlocker::~CBlocker()
 
 //////////////////////////////////////////////////////////////
 
+// write value and error of bin to output, and mask its points
+
+void CBlocker::paintBin(const CSigCalc::cSpanList &spans,
+			double value, double error)
+{
+  CSigCalc::cSpanList::const_iterator s = spans.begin();
+  while( s != spans.end() ) {
+    for(int x = s->m_x1; x < s->m_x2; x++) {
+      m_outImage->SetPixel( x, s->m_y, value );
+      m_errImage->SetPixel( x, s->m_y, error );
+      m_pixelImage->SetPixel( x, s->m_y, m_pixelno );
+    }
+    s++;
+  }
+  m_sigcalc->Mask(spans);
+  m_pixelno++;
+}
+
+//////////////////////////////////////////////////////////////
+
 // my binning algorithm
 // pass over in powers of two, eliminating binned pixels
 // that are below a threshold error
 
+// The blocks of a pass are disjoint, so they can be evaluated in
+// parallel. They are then painted in the original order (x then y) so
+// the bins are numbered the same whatever the number of threads.
+
 void CBlocker::binPass(int factor, int ivalue)
 {
   cout << "    Bin pass " << factor << endl;
 
-  int binnedside = m_side / factor;
-  bool finalpass = (binnedside == 1);
-
-  // loop over binned pixels
-  for(int x = 0; x < binnedside; x++)
-    for(int y = 0; y < binnedside; y++) {
-
-      CSigCalc::cCoordList coordlist;
-
-      // loop over displacement
-      for(int xi = 0; xi < factor; xi++)
-	for(int yi = 0; yi < factor; yi++) {
-	  CCoord pt(x*factor+xi, y*factor+yi);
+  m_passfactor = factor;
+  m_passvalue = ivalue;
+  m_passcols = (m_realxw + factor - 1) / factor;
+  m_passrows = (m_realyw + factor - 1) / factor;
+  m_finalpass = (factor == m_side);
+
+  m_results.assign(m_passcols*m_passrows, CBlockResult());
+  parallel_range(this, &CBlocker::evaluateColumns, m_passcols,
+		 m_nothreads);
+
+  CSigCalc::cSpanList spans;
+  for(int x = 0; x < m_passcols; x++)
+    for(int y = 0; y < m_passrows; y++) {
+      const CBlockResult &res = m_results[x*m_passrows + y];
+      if( ! res.m_binned )
+	continue;
+
+      spans.clear();
+      m_sigcalc->AddUnmaskedSpans(x*factor, y*factor,
+				  std::min((x+1)*factor, m_realxw),
+				  std::min((y+1)*factor, m_realyw),
+				  &spans);
+      paintBin(spans, res.m_value, res.m_error);
+    }
 
-	  if( pt.m_x < m_realxw && pt.m_y < m_realyw &&
-	      ! m_sigcalc->IsMasked(pt) )
-	    coordlist.push_back( pt );
-	}
+  m_results.clear();
+}
 
-      if( ! coordlist.empty() ) {
-	double value = m_sigcalc->GetValue(coordlist, ivalue);
-	double error = m_sigcalc->GetError(coordlist, 0);
-	
-	if( error < m_fracterr || finalpass ) { 
-	  CSigCalc::cCoordList::const_iterator p = coordlist.begin();
-	  double err = m_sigcalc->GetError(coordlist, ivalue);
-	  while( p != coordlist.end() ) {
-	    m_outImage->SetPixel( p->m_x, p->m_y, value );
-	    m_errImage->SetPixel( p->m_x, p->m_y, err );
-	    m_pixelImage->SetPixel( p->m_x, p->m_y, m_pixelno );
-	    m_sigcalc->Mask(*p);
-	    p++;
-	  }
-	  m_pixelno++;
-	}
-	
-      } // coordlist != empty
-      
-    } // over points
+// evaluate the blocks in columns x1<=x<x2 of the current pass
 
+void CBlocker::evaluateColumns(int x1, int x2, unsigned thread)
+{
+  const int factor = m_passfactor;
+
+  CSigCalc::cSpanList spans;
+  std::vector<double> values( m_sigcalc->GetNoValues() );
+  std::vector<double> errors( m_sigcalc->GetNoValues() );
+
+  for(int x = x1; x < x2; x++)
+    for(int y = 0; y < m_passrows; y++) {
+
+      // unmasked points in block
+      spans.clear();
+      m_sigcalc->AddUnmaskedSpans(x*factor, y*factor,
+				  std::min((x+1)*factor, m_realxw),
+				  std::min((y+1)*factor, m_realyw),
+				  &spans);
+      if( spans.empty() )
+	continue;
+
+      m_sigcalc->Evaluate(spans, &values[0], &errors[0]);
+
+      if( errors[0] < m_fracterr || m_finalpass ) {
+	CBlockResult &res = m_results[x*m_passrows + y];
+	res.m_binned = true;
+	res.m_value = values[m_passvalue];
+	res.m_error = errors[m_passvalue];
+      }
+    }
 }
 
 // an alternative non-gridded algorithm
-// very slow
 
-// repeats lots of times to find the most accurate pixels
+// repeatedly picks the block (at any position) with the lowest error
+// the totals of every block position are kept, and a queue of their
+// errors. When a block is binned, only the positions overlapping it
+// are updated, and their old queue entries are ignored when they
+// come out of the queue
 
 void CBlocker::binPassMoveBlock(int factor, int ivalue)
 {
   cout << "    Bin pass " << factor << '\t';
   cout.flush();
 
-  int binnedside = m_side / factor;
-  bool finalpass = (binnedside == 1);
+  bool finalpass = (factor == m_side);
+
+  const int xw = m_realxw, yw = m_realyw;
+  const int nobands = m_sigcalc->GetNoBands();
+  const int stride = nobands+1;     // band totals, then no. of pixels
+
+  // summed-area table of unmasked pixels
+  std::vector<double> table( (xw+1)*(yw+1)*stride, 0. );
+  for(int y = 0; y < yw; y++) {
+    std::vector<double> row(stride, 0.);
+    for(int x = 0; x < xw; x++) {
+      const CCoord pt(x, y);
+      if( ! m_sigcalc->IsMasked(pt) ) {
+	m_sigcalc->GetPixelBands(pt, &row[0]);
+	row[nobands] += 1.;
+      }
+      const double *below = &table[ ((x+1)+y*(xw+1))*stride ];
+      double *here = &table[ ((x+1)+(y+1)*(xw+1))*stride ];
+      for(int i = 0; i < stride; i++)
+	here[i] = below[i] + row[i];
+    }
+  }
 
-  CSigCalc::cCoordVList pixels;
+  // totals of each block position
+  std::vector<double> blocks( xw*yw*stride );
+  std::vector<unsigned> stamps( xw*yw, 0 );
+  std::priority_queue<CBlockCandidate> queue;
+
+  for(int ya = 0; ya < yw; ya++)
+    for(int xa = 0; xa < xw; xa++) {
+      const int x2 = std::min(xa+factor, xw), y2 = std::min(ya+factor, yw);
+      const double *a = &table[ (x2+y2*(xw+1))*stride ];
+      const double *b = &table[ (xa+y2*(xw+1))*stride ];
+      const double *c = &table[ (x2+ya*(xw+1))*stride ];
+      const double *d = &table[ (xa+ya*(xw+1))*stride ];
+      double *tot = &blocks[ (xa+ya*xw)*stride ];
+      for(int i = 0; i < stride; i++)
+	tot[i] = a[i] - b[i] - c[i] + d[i];
+
+      const int count = int(tot[nobands] + 0.5);
+      if( count > 0 ) {
+	const double err = m_sigcalc->GetTotalsError(tot, count, 0);
+	if( err < 1e5 )
+	  queue.push( CBlockCandidate(err, xa, ya, 0) );
+      }
+    }
+  table.clear();
 
-  // loop over binned pixels
+  // totals of pixels in the binned block, to take off overlapping blocks
+  std::vector<double> binned( (factor+1)*(factor+1)*stride );
 
-  while(true) {
-    double minerr = 1e5;
-    CSigCalc::cCoordList minerrblock;
+  std::vector<double> values( m_sigcalc->GetNoValues() );
+  std::vector<double> errors( m_sigcalc->GetNoValues() );
 
-    for(int xa = m_realxw-1; xa >= 0; xa--) {
-      for(int ya = m_realyw-1; ya >= 0; ya--) {
+  while( ! queue.empty() ) {
+    const CBlockCandidate cand = queue.top();
+    queue.pop();
 
-	// get block coords
-	CSigCalc::cCoordList block;
-	for(int xi = factor-1; xi >= 0; xi--)
-	  for(int yi = factor-1; yi >= 0; yi--) {
-	    CCoord pt(xa+xi, ya+yi);
+    // skip out of date entries
+    if( cand.m_stamp != stamps[cand.m_x+cand.m_y*xw] )
+      continue;
 
-	    if(pt.m_x < m_realxw && pt.m_y < m_realyw &&
-	       ! m_sigcalc->IsMasked(pt))
-	      block.push_back(pt);
-	  }
+    if( cand.m_err > m_fracterr && !finalpass )
+      break;
 
-	// does block have minimum error
-	if( ! block.empty() ) {
-	  double err = m_sigcalc->GetError(block, 0);
-	  if(err < minerr) {
-	    minerr = err;
-	    minerrblock = block;
-	  }
+    const int bx = cand.m_x, by = cand.m_y;
+    const int bxw = std::min(factor, xw-bx), byw = std::min(factor, yw-by);
+
+    // get unmasked points in block
+    CSigCalc::cSpanList block;
+    m_sigcalc->AddUnmaskedSpans(bx, by, bx+bxw, by+byw, &block);
+
+    // summed-area table of the block's pixels, before they're masked
+    std::fill(binned.begin(), binned.end(), 0.);
+    for(int yi = 0; yi < byw; yi++) {
+      std::vector<double> row(stride, 0.);
+      for(int xi = 0; xi < bxw; xi++) {
+	const CCoord pt(bx+xi, by+yi);
+	if( ! m_sigcalc->IsMasked(pt) ) {
+	  m_sigcalc->GetPixelBands(pt, &row[0]);
+	  row[nobands] += 1.;
 	}
+	const double *below = &binned[ ((xi+1)+yi*(factor+1))*stride ];
+	double *here = &binned[ ((xi+1)+(yi+1)*(factor+1))*stride ];
+	for(int i = 0; i < stride; i++)
+	  here[i] = below[i] + row[i];
       }
     }
 
-    if( (minerr > m_fracterr && !finalpass) || minerrblock.empty() )
-      break;
-
-    {
-      CSigCalc::cCoordList::const_iterator p = minerrblock.begin();
-      double val = m_sigcalc->GetValue(minerrblock, ivalue);
-      double err = m_sigcalc->GetError(minerrblock, ivalue);
-      while( p != minerrblock.end() ) {
-	m_outImage->SetPixel( p->m_x, p->m_y, val );
-	m_errImage->SetPixel( p->m_x, p->m_y, err );
-	m_pixelImage->SetPixel( p->m_x, p->m_y, m_pixelno );
-	m_sigcalc->Mask(*p);
-	p++;
+    m_sigcalc->Evaluate(block, &values[0], &errors[0]);
+    paintBin(block, values[ivalue], errors[ivalue]);
+
+    // take the binned pixels off the block positions overlapping
+    // this block, and requeue them
+    for(int ya = std::max(by-factor+1, 0); ya < by+byw; ya++)
+      for(int xa = std::max(bx-factor+1, 0); xa < bx+bxw; xa++) {
+	// overlap in coordinates relative to the binned block
+	const int x1 = std::max(xa, bx) - bx;
+	const int y1 = std::max(ya, by) - by;
+	const int x2 = std::min(xa+factor, bx+bxw) - bx;
+	const int y2 = std::min(ya+factor, by+byw) - by;
+
+	const double *a = &binned[ (x2+y2*(factor+1))*stride ];
+	const double *b = &binned[ (x1+y2*(factor+1))*stride ];
+	const double *c = &binned[ (x2+y1*(factor+1))*stride ];
+	const double *d = &binned[ (x1+y1*(factor+1))*stride ];
+	double *tot = &blocks[ (xa+ya*xw)*stride ];
+	for(int i = 0; i < stride; i++)
+	  tot[i] -= a[i] - b[i] - c[i] + d[i];
+
+	const unsigned stamp = ++stamps[xa+ya*xw];
+	const int count = int(tot[nobands] + 0.5);
+	if( count > 0 ) {
+	  const double err = m_sigcalc->GetTotalsError(tot, count, 0);
+	  if( err < 1e5 )
+	    queue.push( CBlockCandidate(err, xa, ya, stamp) );
+	}
       }
-      m_pixelno++;
-    }
 
     cout << "*"; cout.flush();
   }
@@ -254,14 +412,9 @@ namespace AdaptiveBin {
     void writeImages();
 
   private:
-    enum cCalcType { count, colour2, colour3, colour4,
-		     countmb, colour2mb, colour3mb,
-		     colour4mb};
-    static const int noCalcNames=8;
-    
     std::list<std::string> m_fileParams;
     std::string m_outfilename, m_outerrfilename;
-    cCalcType m_type;
+    int m_nobands;                // 1 for count, else colourN
     CSigCalc *m_sigcalc;
     double m_fracterr;
 
@@ -283,24 +436,31 @@ CBlockerProgram::CBlockerProgram(int argc, char *argv[])
   if( argc < 7 )
     errorMessage();
 
-  const char * const calcNames[noCalcNames] = {"count", "colour2",
-					       "colour3", "colour4",
-					       "countmb",
-					       "colour2mb", "colour3mb"
-					       "colour4mb"};
-  const unsigned int noArgs[noCalcNames] = { 1, 2, 3, 4, 1, 2, 3, 4 };
-  const int maxVal[noCalcNames] = { 0, 2, 6, 8, 0, 2, 6, 8 };
-
   string type = argv[1];
 
+  // types ending in mb use the move-block algorithm
+  if( type.size() > 2 && type.substr(type.size()-2) == "mb" ) {
+    m_useAlternateAlgorithm = true;
+    type.erase(type.size()-2);
+  }
+
+  if( type == "count" )
+    m_nobands = 1;
+  else if( type.substr(0, 6) == "colour" ) {
+    istringstream n(type.substr(6));
+    if( ! (n >> m_nobands) || m_nobands < 2 )
+      errorMessage();
+  } else
+    errorMessage();
+
   m_outfilename = argv[2];
   m_outerrfilename = argv[3];
 
   {
-    istrstream a4(argv[4]);
+    istringstream a4(argv[4]);
     if( ! (a4 >> m_fracterr) )
       errorMessage();
-    istrstream a5(argv[5]);
+    istringstream a5(argv[5]);
     if( ! (a5 >> m_value) )
       errorMessage();
   }
@@ -310,23 +470,22 @@ CBlockerProgram::CBlockerProgram(int argc, char *argv[])
     m_fileParams.push_back(argv[i]);
   }
 
-  int it = 0;
-  while( it < noCalcNames && type != calcNames[it] )
-    it++;
-
-  if( it == noCalcNames )
-    errorMessage();
+  // count has one value, colour2 a ratio and two counts, and
+  // colourN (N>2) a ratio, N ratios and N counts
+  int maxval = 0;
+  if( m_nobands == 2 )
+    maxval = 2;
+  else if( m_nobands > 2 )
+    maxval = 2*m_nobands;
 
-  if( m_value > maxVal[it] || m_value < 0 ) {
-    clog << "* Val is not in range 0 - " << maxVal[it]
+  if( m_value > maxval || m_value < 0 ) {
+    clog << "* Val is not in range 0 - " << maxval
 	 << "\n\n";
     errorMessage();
   }
 
-  if( m_fileParams.size() != noArgs[it] )
+  if( int(m_fileParams.size()) != m_nobands )
     errorMessage();
-
-  m_type = (cCalcType) it;
 }
 
 CBlockerProgram::~CBlockerProgram()
@@ -339,71 +498,30 @@ void CBlockerProgram::loadImages()
 {
   // load in images
   std::list<std::string>::const_iterator x = m_fileParams.begin();
-  switch( m_type ) {
-  case count:
-  case countmb:
-    {
-      CFITSFile file( x->c_str(), CFITSFile::existingro );
-      m_outPosn = file.GetPosn();
-      m_sigcalc = new CCountSig( file.GetImage() );
-    }
-    break;
-  case colour2:
-  case colour2mb:
-    {
-      CFITSFile filea( x->c_str(), CFITSFile::existingro );
-      m_outPosn = filea.GetPosn();
-      ++x;
-      CFITSFile fileb( x->c_str(), CFITSFile::existingro );
-      m_sigcalc = new CRatioSig( filea.GetImage(),
-				 fileb.GetImage() );
-    }
-    break;
-  case colour3:
-  case colour3mb:
-    {
-      CFITSFile filea( x->c_str(), CFITSFile::existingro );
-      m_outPosn = filea.GetPosn();
-      ++x;
-      CFITSFile fileb( x->c_str(), CFITSFile::existingro );
-      ++x;
-      CFITSFile filec( x->c_str(), CFITSFile::existingro );
-
-      m_sigcalc = new CRatioSig3( filea.GetImage(),
-				  fileb.GetImage(),
-				  filec.GetImage() );
-    }
-    break;
-  case colour4:
-  case colour4mb:
-    {
-      CFITSFile filea( x->c_str(), CFITSFile::existingro );
-      m_outPosn = filea.GetPosn();
-      ++x;
-      CFITSFile fileb( x->c_str(), CFITSFile::existingro );
-      ++x;
-      CFITSFile filec( x->c_str(), CFITSFile::existingro );
-      ++x;
-      CFITSFile filed( x->c_str(), CFITSFile::existingro );
-
-      m_sigcalc = new CRatioSig4( filea.GetImage(),
-				  fileb.GetImage(),
-				  filec.GetImage(),
-				  filed.GetImage() );
-    }
-    break;
+
+  if( m_nobands == 1 ) {
+    CFITSFile file( x->c_str(), CFITSFile::existingro );
+    m_outPosn = file.GetPosn();
+    m_sigcalc = new CCountSig( file.GetImage() );
+    return;
   }
 
+  std::vector<CFITSImage> images;
+  for( ; x != m_fileParams.end(); ++x ) {
+    CFITSFile file( x->c_str(), CFITSFile::existingro );
+    if( images.empty() )
+      m_outPosn = file.GetPosn();
+    images.push_back( file.GetImage() );
+  }
 
-  if( m_type==countmb || m_type==colour2mb || m_type==colour3mb )
-    m_useAlternateAlgorithm = true;
+  m_sigcalc = new CBandSig( images );
 }
 
 void CBlockerProgram::doCalculation()
 {
   // do the calculations
 
-  CBlocker blocker(m_sigcalc, m_useAlternateAlgorithm);
+  CBlocker blocker(m_sigcalc, m_useAlternateAlgorithm, default_threads());
   blocker.Block(m_fracterr, m_value, &m_outImage, &m_outImageErr,
 		&m_pixelImage);
 }
@@ -447,8 +565,8 @@ void CBlockerProgram::errorMessage()
 	    << ", " << progDate << "), Jeremy Sanders\n\n"
 	    << "  Usage:  AdaptiveBlock type outf outf-err sig val"
 	    << " file1 [file2] [file3] [...]\n\n"
-	    << "type can be count (max val 0), colour2 (mv 2), colour3 (mv 6)\n"
-	    << " colour4 (mv 8) (add mb for move-block [very slow!] method)\n"
+	    << "type can be count (max val 0), colour2 (mv 2), or colourN\n"
+	    << " for N bands (mv 2N) (add mb for move-block method)\n"
 	    << "sig is fractional error\n"
 	    << "val is the value type to return (0 selects default)\n";
   exit(-1);
@@ -26,82 +26,273 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
 
 #include <parammm/parammm.hh>
 #include <FITSFile.h>
+#include "adaptsmooth.hh"
+#include "binmodule.hh"
+#include "parallel.hh"
+#include "version.hh"
 
 using namespace std;
 
-class point
+// a contiguous group of pixels in the same contour, with its extent
+// and moments
+class region
 {
 public:
-  point() : m_x(0), m_y(0) {}
-  point(int x, int y) { m_x = x; m_y = y; }
-  
-  int& x() { return m_x; }
-  int& y() { return m_y; }
-  const int &x() const { return m_x; }
-  const int &y() const { return m_y; }
-
-private:
-  int m_x, m_y;
+  region(int level)
+    : m_level(level), m_count(0), m_first(-1),
+      m_x1(0), m_y1(0), m_x2(-1), m_y2(-1),
+      m_sumx(0.), m_sumy(0.), m_sumxx(0.), m_sumyy(0.), m_sumxy(0.)
+  {}
+
+  void add_pixel(int x, int y, int index);
+  // pixels should be added in raster order
+
+  double major_axis() const;
+  // half-length of the major axis of the ellipse with the same
+  // second moments (treating pixels as unit squares)
+
+  bool oversized(double constrain) const
+  {
+    return m_count > 1 &&
+      major_axis() > constrain * sqrt(m_count / M_PI);
+  }
+  // is the region longer than constrain times the radius of a
+  // circle of the same area?
+
+  int m_level;     // contour of the pixels
+  int m_count;     // number of pixels
+  int m_first;     // index of first pixel
+  int m_x1, m_y1, m_x2, m_y2;   // bounding box (inclusive)
+  double m_sumx, m_sumy, m_sumxx, m_sumyy, m_sumxy;
 };
 
-typedef vector<point> point_vector;
+void region::add_pixel(int x, int y, int index)
+{
+  if( m_count == 0 ) {
+    m_first = index;
+    m_x1 = m_x2 = x;
+    m_y1 = m_y2 = y;
+  } else {
+    m_x1 = min(m_x1, x); m_x2 = max(m_x2, x);
+    m_y2 = y;
+  }
+
+  ++m_count;
+  m_sumx += x; m_sumy += y;
+  m_sumxx += double(x)*x; m_sumyy += double(y)*y; m_sumxy += double(x)*y;
+}
+
+double region::major_axis() const
+{
+  const double mx = m_sumx/m_count, my = m_sumy/m_count;
+  const double vxx = m_sumxx/m_count - mx*mx + 1./12;
+  const double vyy = m_sumyy/m_count - my*my + 1./12;
+  const double vxy = m_sumxy/m_count - mx*my;
+
+  // largest eigenvalue of the covariance matrix
+  const double half_diff = 0.5*(vxx-vyy);
+  const double lmax = 0.5*(vxx+vyy) + sqrt(half_diff*half_diff + vxy*vxy);
+
+  // a uniform ellipse has variance a^2/4 along its major axis
+  return 2.*sqrt( max(lmax, 0.) );
+}
+
+// number of levels <= val, for n levels in ascending order
+// this is a binary search with no branches in the loop, so it takes
+// the same time for every pixel
+inline int count_levels_below(const double *levels, int n, double val)
+{
+  const double *base = levels;
+  while( n > 1 ) {
+    const int half = n / 2;
+    base = (base[half] <= val) ? base+half : base;
+    n -= half;
+  }
+  return int(base-levels) + (*base <= val);
+}
 
 ////////////////////////////////////////////////////////////
 
 class contour_prog
 {
 public:
-  contour_prog();
+  contour_prog(int argc, char **argv);
   ~contour_prog();
 
   void run();
 
 private:
   void read_contours(const string &filename);
-  void read_smoothed_image(const string &filename);
+  void make_auto_levels();
+  void finish_levels();
+
+  void read_image();
+  void smooth_image();
+  void write_smoothed(const string &filename);
 
   void make_contours();
-  void check_contour_contig(int cont);
+  void assign_levels(int y1, int y2, unsigned thread);
+  void label_regions();
+  void constrain_regions();
+  void split_regions(int r1, int r2, unsigned thread);
 
   void paint_binmap();
   void write_binmap(const string &filename);
 
 private:
   vector<double> m_contours;
-  vector<point_vector*> m_contour_points;
 
   CFITSImage m_smoothed_image, m_out_image;
   CFITSPosn m_posn;
 
+  vector<int> m_level_image;   // contour of each pixel (-1 if none)
+  vector<int> m_region_image;  // region of each pixel (-1 if none)
+  vector<region> m_regions;
+  vector< vector< vector<int> > > m_split_pixels;  // pixels of the
+                                                   // parts of each region
+
   int m_xw, m_yw;
+
+  // options
+  vector<string> m_args;       // input image (and backgrounds)
+  string m_contours_fname;     // file of contour levels
+  string m_binmap_fname;       // output binmap
+  string m_smoothed_fname;     // output smoothed image (optional)
+  string m_smooth;             // none, gaussian or adaptive
+  double m_sigma;              // gaussian smoothing sigma
+  double m_smooth_sn;          // signal to noise for adaptive smoothing
+  int m_nolevels;              // number of automatic levels (0 to read)
+  double m_constrain;          // geometric constraint (0 for none)
+  string m_spacing;            // spacing of automatic levels
+  int m_threads;               // number of threads (0 for all cpus)
 };
 
 //////////////////////////////////////////////////////////////////////
 
-contour_prog::contour_prog()
+contour_prog::contour_prog(int argc, char **argv)
+  : m_xw(0), m_yw(0),
+    m_contours_fname("contours.txt"),
+    m_binmap_fname("contour_binmap.fits"),
+    m_smooth("none"),
+    m_sigma(2.),
+    m_smooth_sn(15.),
+    m_nolevels(0),
+    m_constrain(0.),
+    m_spacing("quantile"),
+    m_threads(0)
 {
+  parammm::param params(argc, argv);
+
+  params.add_switch( parammm::pswitch("binmap", 'n',
+				      parammm::pstring_opt(&m_binmap_fname),
+				      "set binmap out file "
+				      "(def contour_binmap.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("contours", 'c',
+				      parammm::pstring_opt(&m_contours_fname),
+				      "set file of contour levels "
+				      "(def contours.txt)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("levels", 'l',
+				      parammm::pint_opt(&m_nolevels),
+				      "make this many levels automatically "
+				      "instead of reading them",
+				      "INT"));
+  params.add_switch( parammm::pswitch("spacing", 0,
+				      parammm::pstring_opt(&m_spacing),
+				      "spacing of automatic levels "
+				      "(quantile or log, def quantile)",
+				      "STR"));
+  params.add_switch( parammm::pswitch("smooth", 's',
+				      parammm::pstring_opt(&m_smooth),
+				      "smooth the image first "
+				      "(none, gaussian or adaptive, def none)",
+				      "STR"));
+  params.add_switch( parammm::pswitch("sigma", 'g',
+				      parammm::pdouble_opt(&m_sigma),
+				      "set gaussian smoothing sigma (def 2)",
+				      "PIX"));
+  params.add_switch( parammm::pswitch("smoothsn", 0,
+				      parammm::pdouble_opt(&m_smooth_sn),
+				      "set adaptive smoothing signal:noise "
+				      "(def 15)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("smoothed", 0,
+				      parammm::pstring_opt(&m_smoothed_fname),
+				      "set smoothed out file (optional)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("constrain", 0,
+				      parammm::pdouble_opt(&m_constrain),
+				      "split regions longer than this times "
+				      "the radius of a circle of the same "
+				      "area (def none, try 2)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
+
+  params.set_autohelp("Usage: AdaptiveContour [OPTIONS] [file bg=count...]\n"
+		      "Makes a binmap from the contours of a (smoothed) "
+		      "image\n"
+		      "The image defaults to smoothed.fits. Backgrounds are "
+		      "used by adaptive smoothing.\n"
+		      "Written by Jeremy Sanders, 2000, 2001.",
+		      "Report bugs to <jss@ast.cam.ac.uk>");
+  params.enable_autohelp();
+  params.enable_autoversion(c_adbin_version,
+			    "Jeremy Sanders",
+			    "Licenced under the GPL - see the file COPYING");
+  params.enable_at_expansion();
+
+  params.interpret_and_catch();
+
+  m_args = params.args();
+  if( m_args.empty() )
+    m_args.push_back("smoothed.fits");
+
+  if( m_smooth != "none" && m_smooth != "gaussian" &&
+      m_smooth != "adaptive" )
+    params.show_autohelp();
+  if( m_spacing != "quantile" && m_spacing != "log" )
+    params.show_autohelp();
+  if( m_sigma <= 0. || m_smooth_sn <= 0. || m_nolevels < 0 ||
+      m_constrain < 0. )
+    params.show_autohelp();
+
+  if( m_threads <= 0 )
+    m_threads = AdaptiveBin::default_threads();
 }
 
 contour_prog::~contour_prog()
 {
-  for(int i=0; i<int(m_contour_points.size()); ++i)
-    delete m_contour_points[i];
-
-  m_contour_points.clear();
 }
 
 void contour_prog::run()
 {
-  read_contours("contours.txt");
-  read_smoothed_image("smoothed.fits");
+  if( m_smooth == "adaptive" )
+    smooth_image();
+  else
+    read_image();
+
+  if( m_nolevels > 0 )
+    make_auto_levels();
+  else
+    read_contours(m_contours_fname);
+  finish_levels();
+
+  if( ! m_smoothed_fname.empty() )
+    write_smoothed(m_smoothed_fname);
 
   make_contours();
   paint_binmap();
 
-  write_binmap("contour_binmap.fits");
+  write_binmap(m_binmap_fname);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -114,8 +305,6 @@ void contour_prog::read_contours(const string &filename)
     exit(1);
   }
 
-  m_contours.push_back(-1e30);
-
   while( ! clist.eof() ) {
     string line;
     getline(clist, line);
@@ -137,159 +326,484 @@ void contour_prog::read_contours(const string &filename)
     m_contours.push_back(cont);
   }
 
-  m_contours.push_back(1e30);
-
   cout << "Read list of contours in " << filename << endl;
+}
+
+// levels at quantiles of the pixel values, or spaced logarithmically
+// between the lowest positive and highest values
+// the quantiles come from a histogram of the values, so the image is
+// only scanned twice (for the range, then the histogram)
+void contour_prog::make_auto_levels()
+{
+  const CFloatType *image = m_smoothed_image.GetConstImageBuffer();
+  const int nopixels = m_xw*m_yw;
+
+  double minval = 1e300, maxval = -1e300, minpos = 1e300;
+  int nogood = 0;
+  for(int i=0; i<nopixels; ++i) {
+    const double v = image[i];
+    if( std::isnan(v) )
+      continue;
+    minval = min(minval, v);
+    maxval = max(maxval, v);
+    if( v > 0. )
+      minpos = min(minpos, v);
+    ++nogood;
+  }
+
+  if( nogood == 0 || maxval <= minval ) {
+    cerr << "Image has no range of values to make levels from" << endl;
+    exit(1);
+  }
 
-  for(int i=0; i<int(m_contours.size()); ++i)
-    m_contour_points.push_back( new point_vector );
+  if( m_spacing == "log" ) {
+    if( maxval <= 0. || minpos >= maxval ) {
+      cerr << "Image has no range of positive values for log levels"
+	   << endl;
+      exit(1);
+    }
+
+    for(int k=1; k<=m_nolevels; ++k)
+      m_contours.push_back( minpos *
+			    pow(maxval/minpos, double(k)/(m_nolevels+1)) );
+  } else {
+    const int c_nobins = 65536;
+    const double binwidth = (maxval-minval) / c_nobins;
+
+    vector<int> hist(c_nobins, 0);
+    for(int i=0; i<nopixels; ++i) {
+      const double v = image[i];
+      if( std::isnan(v) )
+	continue;
+      const int bin = min( int((v-minval)/binwidth), c_nobins-1 );
+      ++hist[bin];
+    }
+
+    // walk up the histogram, interpolating within the bin where each
+    // quantile falls
+    double below = 0.;
+    int bin = 0;
+    for(int k=1; k<=m_nolevels; ++k) {
+      const double target = double(nogood)*k/(m_nolevels+1);
+      while( bin < c_nobins-1 && below+hist[bin] < target )
+	below += hist[bin++];
+
+      const double frac = hist[bin] > 0 ?
+	(target-below) / hist[bin] : 0.;
+      m_contours.push_back( minval + (bin+frac)*binwidth );
+    }
+  }
+
+  cout << "Made " << m_nolevels << " " << m_spacing << " levels:";
+  for(unsigned i=0; i<m_contours.size(); ++i)
+    cout << ' ' << m_contours[i];
+  cout << endl;
 }
 
-void contour_prog::read_smoothed_image(const string &filename)
+void contour_prog::finish_levels()
 {
-  CFITSFile imagefile(filename.c_str(), CFITSFile::existingro);
+  // levels are looked up by binary search, with a level below and
+  // above everything
+  m_contours.push_back(-1e30);
+  m_contours.push_back(1e30);
+  sort(m_contours.begin(), m_contours.end());
+  m_contours.erase( unique(m_contours.begin(), m_contours.end()),
+		    m_contours.end() );
+}
+
+void contour_prog::read_image()
+{
+  {
+    CFITSFile imagefile(m_args[0].c_str(), CFITSFile::existingro);
 
-  m_smoothed_image = imagefile.GetImage();
-  m_posn = imagefile.GetPosn();
+    m_smoothed_image = imagefile.GetImage();
+    m_posn = imagefile.GetPosn();
+  }
 
   m_xw = m_smoothed_image.GetXW();
   m_yw = m_smoothed_image.GetYW();
 
   m_out_image.Resize(m_xw, m_yw);
+  m_out_image.SetAll(-1);
+
+  if( m_smooth == "gaussian" ) {
+    const CFloatType *in = m_smoothed_image.GetConstImageBuffer();
+    const vector<double> image(in, in + m_xw*m_yw);
+    vector<double> smoothed;
+
+    AdaptiveBin::gaussian_smoother smoother(m_xw, m_yw, m_sigma);
+    smoother.smooth(image, &smoothed, m_threads);
+
+    // the smoother fills in blank pixels from their neighbours, but
+    // they should stay out of the contours
+    for(int i=0; i<m_xw*m_yw; ++i)
+      if( std::isnan(image[i]) )
+	smoothed[i] = image[i];
+
+    copy(smoothed.begin(), smoothed.end(),
+	 m_smoothed_image.GetImageBuffer());
+    cout << "Smoothed image with gaussian of sigma " << m_sigma << endl;
+  }
+}
+
+// adaptively smooth the counts in the input images (less background)
+void contour_prog::smooth_image()
+{
+  AdaptiveBin::ratio_binmodule *binmod = 0;
+  try {
+    binmod = new AdaptiveBin::ratio_binmodule(m_args);
+  }
+  catch(AdaptiveBin::invalidargs_exception e) {
+    cerr << "Invalid files listed" << endl;
+    exit(1);
+  }
+
+  m_xw = binmod->xw();
+  m_yw = binmod->yw();
+  binmod->getposn(&m_posn);
+
+  vector<double> smoothed, scale;
+  {
+    AdaptiveBin::adaptive_smoother smoother(binmod, 1./m_smooth_sn);
+    smoother.smooth(&smoothed, &scale, m_threads);
+  }
+  delete binmod;
+
+  m_smoothed_image.Resize(m_xw, m_yw);
+  copy(smoothed.begin(), smoothed.end(),
+       m_smoothed_image.GetImageBuffer());
+
+  m_out_image.Resize(m_xw, m_yw);
+  m_out_image.SetAll(-1);
+
+  cout << "Adaptively smoothed image to signal:noise "
+       << m_smooth_sn << endl;
+}
+
+void contour_prog::write_smoothed(const string &filename)
+{
+  CFITSFile fileout(filename.c_str(), CFITSFile::create);
+
+  fileout.SetImage(m_smoothed_image);
+  fileout.SetPosn(m_posn);
+
+  fileout.WriteImage();
 }
 
 void contour_prog::make_contours()
 {
   // find out which contour each pixel represents
-  for(int y=0; y<m_yw; ++y)
-    for(int x=0; x<m_xw; ++x) {
-      const double pix = m_smoothed_image.GetPixel(x, y);
+  m_level_image.resize(m_xw*m_yw);
+  AdaptiveBin::parallel_range(this, &contour_prog::assign_levels,
+			      m_yw, m_threads);
 
-      int cont = m_contours.size()-1;
-      while( m_contours[cont]>pix && cont >= 0 )
-	--cont;
+  label_regions();
 
-      ++cont;
+  if( m_constrain > 0. )
+    constrain_regions();
+}
 
-      m_contour_points[cont] -> push_back( point(x, y) );
-    }
+void contour_prog::assign_levels(int y1, int y2, unsigned thread)
+{
+  const double *levels = &m_contours[0];
+  const int nolevels = m_contours.size();
+  const CFloatType *image = m_smoothed_image.GetConstImageBuffer();
+
+  for(int y=y1; y<y2; ++y) {
+    const CFloatType *in = image + y*m_xw;
+    int *out = &m_level_image[y*m_xw];
+
+    for(int x=0; x<m_xw; ++x) {
+      const double pix = in[x];
+
+      // pixels above the top level go in the last contour
+      const int cont = min( count_levels_below(levels, nolevels, pix),
+			    nolevels-1 );
 
-  for(int i = m_contour_points.size()-1;  i >= 0; --i)
-    check_contour_contig(i);
+      // blank (NaN) pixels are not in any contour
+      out[x] = std::isnan(pix) ? -1 : cont;
+    }
+  }
 }
 
-void contour_prog::check_contour_contig(int cont)
+namespace
 {
-  vector<point_vector*> split_bins; 
-
-  CFITSImage pixels(m_xw, m_yw);
-  point_vector *bin = m_contour_points[cont];
-
-  const int nopixels = bin->size();
-  if(nopixels == 0) return;
-
-  vector<bool> pixel_used;
-  for(int i=nopixels-1; i>=0; i--)
-    pixel_used.push_back(false);
-  
-  for(;;) {
-
-    // find next available pixel
-    int next_pixel = 0;
-    while(next_pixel<nopixels && pixel_used[next_pixel])
-      next_pixel++;
-    
-    if(next_pixel == nopixels)
-      break; // no more chunks available
-    
-    // make an image to hold processed pixels
-    const int xw = m_out_image.GetXW() + 1;
-    const int yw = m_out_image.GetYW() + 1;
-    bool *bin_image = new bool[xw*yw];
-    for(int i=0; i<xw*yw; i++)
-      bin_image[i] = false;
-    
-    // try and build 'chunk'
-    point_vector *chunk = new point_vector;
-    const point &first = (*bin)[next_pixel];
-    chunk->push_back(first);
-    bin_image[ first.x() + xw*first.y() ] = true;
-    
-    for(;;) {  // loop, adding contig pixels, until there are no more
-      bool added_any = false;
-      
-      // loop over pixels in input bin
-      for(int pix=0; pix<nopixels; pix++) {
-	const point &curr = (*bin)[pix];
-	
-	if( ! pixel_used[pix] ) {  // if the pixel is left to process
-	  
-	  // go over already added pixels, and see whether this pixel
-	  // is contiguous
-	  
-	  bool is_contig = false;
-	  
-	  for(int y=-1; y<=1; y++)
-	    for(int x=-1; x<=1; x++) {
-	      const int xp = curr.x() + x;
-	      const int yp = curr.y() + y;
-	      
-	      if( xp >= 0 && yp >= 0 ) {
-		if( bin_image[xp+yp*xw] )
-		  is_contig = true;
-	      }
-	    } 
-	  
-	  if(is_contig) {
-	    added_any = true;
-	    pixel_used[pix] = true;
-	    chunk->push_back(curr);
-	    bin_image[curr.x()+curr.y()*xw] = true;
+  // root of a label in a union-find forest, halving the path
+  inline int find_root(vector<int> &parent, int label)
+  {
+    while( parent[label] != label ) {
+      parent[label] = parent[ parent[label] ];
+      label = parent[label];
+    }
+    return label;
+  }
+
+  // join two sets, keeping the lowest label as the root
+  inline int join_labels(vector<int> &parent, int a, int b)
+  {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if( a < b )
+      parent[b] = a;
+    else
+      parent[a] = b;
+    return min(a, b);
+  }
+
+  // split pixels (indices in raster order) into 8-connected pieces,
+  // each in raster order
+  void connected_pieces(const vector<int> &pixels, int xw,
+			vector< vector<int> > *pieces)
+  {
+    int x1 = xw, y1 = pixels.front() / xw, x2 = 0, y2 = pixels.back() / xw;
+    for(unsigned i=0; i<pixels.size(); ++i) {
+      x1 = min(x1, pixels[i] % xw);
+      x2 = max(x2, pixels[i] % xw);
+    }
+
+    // position in pixels of each point in the bounding box, or -1
+    const int bw = x2-x1+1, bh = y2-y1+1;
+    vector<int> box(bw*bh, -1);
+    for(unsigned i=0; i<pixels.size(); ++i)
+      box[ (pixels[i]%xw - x1) + (pixels[i]/xw - y1)*bw ] = i;
+
+    vector<int> stack;
+    for(unsigned i=0; i<pixels.size(); ++i) {
+      const int start = (pixels[i]%xw - x1) + (pixels[i]/xw - y1)*bw;
+      if( box[start] < 0 )
+	continue;
+
+      vector<int> piece;
+      stack.push_back(start);
+      box[start] = -1;
+      piece.push_back(pixels[i]);
+
+      while( ! stack.empty() ) {
+	const int b = stack.back();
+	stack.pop_back();
+	const int bx = b % bw, by = b / bw;
+
+	for(int dy=-1; dy<=1; ++dy)
+	  for(int dx=-1; dx<=1; ++dx) {
+	    const int nx = bx+dx, ny = by+dy;
+	    if( nx < 0 || nx >= bw || ny < 0 || ny >= bh )
+	      continue;
+	    const int n = nx+ny*bw;
+	    if( box[n] < 0 )
+	      continue;
+	    piece.push_back( pixels[ box[n] ] );
+	    box[n] = -1;
+	    stack.push_back(n);
 	  }
-	  
-	} // pixel_used
-	
-      } // loop over pixels
-      
-      if(!added_any) break;
-    } // repeating loop over pixels
-    
-    split_bins.push_back(chunk);
-    
-    delete[] bin_image;
-
-  }  // try another chunk
-
-  // get rid of original bin
-  delete bin;
-
-  // add new split bins on
-  m_contour_points[cont] = split_bins[0];
-  for(int i=1; i<int(split_bins.size()); i++)
-    m_contour_points.push_back( split_bins[i] );
-
-  split_bins.clear();
+      }
+
+      sort(piece.begin(), piece.end());
+      pieces->push_back(piece);
+    }
+  }
+
+  // split pixels (in raster order) across the major axis through
+  // their centroid until every part meets the constraint
+  void bisect_pixels(const vector<int> &pixels, int xw, double constrain,
+		     vector< vector<int> > *parts)
+  {
+    region reg(0);
+    for(unsigned i=0; i<pixels.size(); ++i)
+      reg.add_pixel(pixels[i] % xw, pixels[i] / xw, pixels[i]);
+
+    if( ! reg.oversized(constrain) ) {
+      parts->push_back(pixels);
+      return;
+    }
+
+    const double n = reg.m_count;
+    const double mx = reg.m_sumx/n, my = reg.m_sumy/n;
+    const double vxx = reg.m_sumxx/n - mx*mx;
+    const double vyy = reg.m_sumyy/n - my*my;
+    const double vxy = reg.m_sumxy/n - mx*my;
+    const double theta = 0.5*atan2(2.*vxy, vxx-vyy);
+    const double ux = cos(theta), uy = sin(theta);
+
+    vector<int> halves[2];
+    for(unsigned i=0; i<pixels.size(); ++i) {
+      const double along = (pixels[i]%xw - mx)*ux + (pixels[i]/xw - my)*uy;
+      halves[ along < 0. ? 0 : 1 ].push_back(pixels[i]);
+    }
+    if( halves[0].empty() || halves[1].empty() ) {
+      parts->push_back(pixels);
+      return;
+    }
+
+    // a half may not be contiguous, so split each into pieces
+    for(int h=0; h<2; ++h) {
+      vector< vector<int> > pieces;
+      connected_pieces(halves[h], xw, &pieces);
+      for(unsigned p=0; p<pieces.size(); ++p)
+	bisect_pixels(pieces[p], xw, constrain, parts);
+    }
+  }
+
+  bool first_pixel_less(const vector<int> &a, const vector<int> &b)
+  {
+    return a.front() < b.front();
+  }
 }
 
-void contour_prog::paint_binmap()
+// split each contour into 8-connected regions
+// the first pass gives each pixel a provisional label, joining the
+// labels of touching pixels already seen, and the second pass
+// replaces them by regions numbered in order of their first pixel
+void contour_prog::label_regions()
 {
-  int val = 0;
+  const int nopixels = m_xw*m_yw;
+  vector<int> parent;
+  m_region_image.assign(nopixels, -1);
+
+  for(int y=0; y<m_yw; ++y)
+    for(int x=0; x<m_xw; ++x) {
+      const int i = x+y*m_xw;
+      const int level = m_level_image[i];
+      if( level < 0 )
+	continue;
+
+      // neighbours already labelled, in this row and the previous one
+      int label = -1;
+      const int nx[4] = { x-1, x-1, x, x+1 };
+      const int ny[4] = { y, y-1, y-1, y-1 };
+      for(int n=0; n<4; ++n) {
+	if( nx[n] < 0 || nx[n] >= m_xw || ny[n] < 0 )
+	  continue;
+	const int j = nx[n]+ny[n]*m_xw;
+	if( m_level_image[j] != level )
+	  continue;
+
+	if( label < 0 )
+	  label = find_root(parent, m_region_image[j]);
+	else
+	  label = join_labels(parent, label, m_region_image[j]);
+      }
+
+      if( label < 0 ) {
+	label = parent.size();
+	parent.push_back(label);
+      }
+      m_region_image[i] = label;
+    }
 
-  for(int i=m_contour_points.size()-1; i >= 0; --i) {
-    const point_vector *bin = m_contour_points[i];
+  vector<int> region_of_label(parent.size(), -1);
+  m_regions.clear();
 
-    if(bin->empty())
+  for(int i=0; i<nopixels; ++i) {
+    if( m_region_image[i] < 0 )
       continue;
 
-    int count = 0;
-    for(int j=bin->size()-1; j >= 0; --j) {
-      const point &p = (*bin)[j];
-      
-      m_out_image.SetPixel( p.x(), p.y(), val );
-      ++count;
+    const int root = find_root(parent, m_region_image[i]);
+    if( region_of_label[root] < 0 ) {
+      region_of_label[root] = m_regions.size();
+      m_regions.push_back( region(m_level_image[i]) );
     }
-    ++val;
+
+    const int r = region_of_label[root];
+    m_region_image[i] = r;
+    m_regions[r].add_pixel(i % m_xw, i / m_xw, i);
   }
+
+  cout << "Split " << m_contours.size() << " contours into "
+       << m_regions.size() << " regions" << endl;
+}
+
+// split regions which are too long for their area
+// the regions are independent, so they are split in parallel
+void contour_prog::constrain_regions()
+{
+  const int noregions = m_regions.size();
+  m_split_pixels.clear();
+  m_split_pixels.resize(noregions);
+
+  AdaptiveBin::parallel_range(this, &contour_prog::split_regions,
+			      noregions, m_threads);
+
+  // the part with the first pixel keeps the region number, and the
+  // others become new regions in the same contour
+  int nosplit = 0;
+  for(int r=0; r<noregions; ++r) {
+    vector< vector<int> > &parts = m_split_pixels[r];
+    if( parts.size() <= 1 )
+      continue;
+
+    ++nosplit;
+    sort(parts.begin(), parts.end(), first_pixel_less);
+    const int level = m_regions[r].m_level;
+
+    for(unsigned p=0; p<parts.size(); ++p) {
+      const int newr = p == 0 ? r : int(m_regions.size());
+      region reg(level);
+      for(unsigned i=0; i<parts[p].size(); ++i) {
+	const int pix = parts[p][i];
+	reg.add_pixel(pix % m_xw, pix / m_xw, pix);
+	m_region_image[pix] = newr;
+      }
+
+      if( p == 0 )
+	m_regions[r] = reg;
+      else
+	m_regions.push_back(reg);
+    }
+  }
+  m_split_pixels.clear();
+
+  cout << "Split " << nosplit << " oversized regions, making "
+       << m_regions.size() << " regions" << endl;
+}
+
+void contour_prog::split_regions(int r1, int r2, unsigned thread)
+{
+  for(int r=r1; r<r2; ++r) {
+    const region &reg = m_regions[r];
+    if( ! reg.oversized(m_constrain) )
+      continue;
+
+    // collect the pixels from the bounding box
+    vector<int> pixels;
+    pixels.reserve(reg.m_count);
+    for(int y=reg.m_y1; y<=reg.m_y2; ++y)
+      for(int x=reg.m_x1; x<=reg.m_x2; ++x)
+	if( m_region_image[x+y*m_xw] == r )
+	  pixels.push_back(x+y*m_xw);
+
+    bisect_pixels(pixels, m_xw, m_constrain, &m_split_pixels[r]);
+  }
+}
+
+void contour_prog::paint_binmap()
+{
+  // the regions of each contour, in order of their first pixel
+  const int nocontours = m_contours.size();
+  vector< vector<int> > contour_regions(nocontours);
+  vector< pair<int,int> > order;
+  for(int r=0; r<int(m_regions.size()); ++r)
+    order.push_back( make_pair(m_regions[r].m_first, r) );
+  sort(order.begin(), order.end());
+  for(unsigned i=0; i<order.size(); ++i) {
+    const int r = order[i].second;
+    contour_regions[ m_regions[r].m_level ].push_back(r);
+  }
+
+  // bins are numbered as they always have been: the extra regions of
+  // each contour from the bottom contour up (last region first), then
+  // the first region of each contour from the top contour down
+  vector<int> binno(m_regions.size());
+  int val = 0;
+  for(int c=0; c<nocontours; ++c)
+    for(int j=int(contour_regions[c].size())-1; j >= 1; --j)
+      binno[ contour_regions[c][j] ] = val++;
+  for(int c=nocontours-1; c >= 0; --c)
+    if( ! contour_regions[c].empty() )
+      binno[ contour_regions[c][0] ] = val++;
+
+  CFloatType *out = m_out_image.GetImageBuffer();
+  for(int i=0; i<m_xw*m_yw; ++i)
+    out[i] = m_region_image[i] < 0 ? -1 : binno[ m_region_image[i] ];
 }
 
 
@@ -304,9 +818,9 @@ void contour_prog::write_binmap(const string &filename)
 }
 
 
-int main()
+int main(int argc, char *argv[])
 {
-  contour_prog program;
+  contour_prog program(argc, argv);
   program.run();
 
   return 0;
@@ -0,0 +1,265 @@
+//      Adaptive Binning Program
+//      Adaptive smoothing - smooth each pixel with the smallest kernel
+//                           reaching a fractional error
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <parammm/parammm.hh>
+#include <FITSFile.h>
+
+#include "binmodule.hh"
+#include "adaptsmooth.hh"
+#include "maskimage.hh"
+#include "parallel.hh"
+#include "version.hh"
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::clog;
+using std::endl;
+using std::ostringstream;
+
+class prog
+{
+public:
+  prog(int argc, char **argv);
+  ~prog();
+  void run();
+
+private:
+  void add_history_list(CFITSFile *file);
+
+public:
+  AdaptiveBin::binmodule *m_binmod;
+  AdaptiveBin::adaptive_smoother::kernel m_kernel;
+  double m_threshold;    // threshold value
+  int m_threads;         // number of threads (0 for all cpus)
+  string m_out_fname;    // output smoothed filename
+  string m_scale_fname;  // output kernel scale filename
+  string m_mask_fname;   // filename of the mask to use (optional)
+  string m_value;        // quantity to smooth
+  string m_kernel_name;  // name of kernel
+  bool m_verbose;        // display verbose information
+  bool m_invert_mask;    // invert 0 and 1 in mask
+
+  vector<string> m_history_list;
+};
+
+prog::prog(int argc, char **argv)
+  : m_binmod(0),
+    m_kernel(AdaptiveBin::adaptive_smoother::box),
+    m_threshold(0.1),
+    m_threads(0),
+    m_out_fname("adsmooth_out.fits"),
+    m_scale_fname("adsmooth_scale.fits"),
+    m_value("count(0)"),
+    m_kernel_name("box"),
+    m_verbose(false),
+    m_invert_mask(false)
+{
+  parammm::param params(argc, argv);
+  params.add_switch( parammm::pswitch("out", 'o',
+				      parammm::pstring_opt(&m_out_fname),
+				      "set out file (def adsmooth_out.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("scale", 's',
+				      parammm::pstring_opt(&m_scale_fname),
+				      "set kernel radius file "
+				      "(def adsmooth_scale.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("mask", 'm',
+				      parammm::pstring_opt(&m_mask_fname),
+				      "set input mask filename (optional)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("threshold", 't',
+				      parammm::pdouble_opt(&m_threshold),
+				      "set threshold fraction (def 10%)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("kernel", 'k',
+				      parammm::pstring_opt(&m_kernel_name),
+				      "set kernel (box or tophat, def box)",
+				      "STR"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("value", 'v',
+				      parammm::pstring_opt(&m_value),
+				      "set output value (eg count(0), "
+				      "ratio(1,2))", "STR") );
+  params.add_switch( parammm::pswitch("invertmask", 0,
+				      parammm::pbool_noopt(&m_invert_mask),
+				      "invert input mask image",
+				      ""));
+  params.add_switch( parammm::pswitch("verbose", 0,
+				      parammm::pbool_noopt(&m_verbose),
+				      "display more information",
+				      ""));
+
+  params.set_autohelp("Usage: AdaptiveSmooth [OPTIONS] file bg=count...\n"
+		      "Adaptively smooths a set of images\n"
+		      "Written by Jeremy Sanders, 2000, 2001.",
+		      "Report bugs to <jss@ast.cam.ac.uk>");
+  params.enable_autohelp();
+  params.enable_autoversion(c_adbin_version,
+			    "Jeremy Sanders",
+			    "Licenced under the GPL - see the file COPYING");
+  params.enable_at_expansion();
+
+  params.interpret_and_catch();
+
+  if(params.args().size() < 1)
+    params.show_autohelp();
+
+  if( ! AdaptiveBin::adaptive_smoother::lookup_kernel(m_kernel_name,
+						      &m_kernel) ) {
+    clog << "Invalid kernel " << m_kernel_name << "\n\n";
+    params.show_autohelp();
+  }
+
+  if(m_threads <= 0)
+    m_threads = AdaptiveBin::default_threads();
+
+  try {
+    // select external if specified
+    const string first8(m_value, 0, 8);
+    if( first8 == "external" )
+      m_binmod = new AdaptiveBin::external_binmodule(params.args());
+    else
+      m_binmod = new AdaptiveBin::ratio_binmodule(params.args());
+    m_binmod->selectvalue(m_value);
+  }
+  catch(AdaptiveBin::invalidargs_exception e) {
+    clog << "Invalid files listed\n\n";
+    params.show_autohelp();
+  }
+  catch(AdaptiveBin::invalidvalue_exception e) {
+    clog << "Invalid output value\n\n";
+    params.show_autohelp();
+  }
+
+  cout << "Using value "
+       << m_binmod->get_value_descr() << endl;
+
+  {
+    // stuff to write into history in fits output files
+    m_history_list.push_back(string("file created by AdaptiveSmooth v. ")
+			     + c_adbin_version);
+
+    for(int i = 0; i<int(params.args().size()); ++i) {
+      ostringstream o;
+      o << "arg " << i << ": " << params.args()[i];
+      m_history_list.push_back( o.str() );
+    }
+
+    m_history_list.push_back( string("output image: ") + m_out_fname );
+    m_history_list.push_back( string("scale map: ") + m_scale_fname );
+
+    m_history_list.push_back( string("mask: ") + m_mask_fname );
+    m_history_list.push_back( string("value: ") + m_binmod->get_value_descr() );
+    m_history_list.push_back( string("kernel: ") + m_kernel_name );
+
+    {
+      ostringstream o;
+      o << "threshold: " << m_threshold;
+      m_history_list.push_back( o.str() );
+    }
+  } // end history comments
+
+  // write history to screen if verbose option is on
+  if(m_verbose) {
+    cout << "\nHeader lines written to output files:\n";
+    for(int i=0; i<int(m_history_list.size()); ++i)
+      cout << m_history_list[i] << endl;
+    cout << endl;
+  }
+}
+
+prog::~prog()
+{
+  if(m_binmod != 0)
+    delete m_binmod;
+}
+
+void prog::add_history_list(CFITSFile *file)
+{
+  const int no = m_history_list.size();
+
+  for(int i=0; i<no; ++i) {
+    const string line = "adbin: " + m_history_list[i];
+    file -> WriteHistory(line.c_str());
+  }
+}
+
+void prog::run()
+{
+  const int xw = m_binmod->xw(), yw = m_binmod->yw();
+
+  vector<bool> masked(xw*yw, false);
+  if( ! m_mask_fname.empty() )
+    AdaptiveBin::read_mask(m_mask_fname, xw, yw, m_invert_mask, &masked);
+
+  cout << "Smoothing" << endl;
+  AdaptiveBin::adaptive_smoother smoother(m_binmod, m_threshold,
+					  m_kernel, &masked);
+  vector<double> smoothed, scale;
+  smoother.smooth(&smoothed, &scale, m_threads);
+
+  CFITSImage out(xw, yw), scaleimg(xw, yw);
+  for(int y=0; y<yw; ++y)
+    for(int x=0; x<xw; ++x) {
+      out.SetPixel(x, y, smoothed[x+y*xw]);
+      scaleimg.SetPixel(x, y, scale[x+y*xw]);
+    }
+
+  CFITSPosn posn;
+  m_binmod -> getposn(&posn);
+
+  {
+    CFITSFile outf(m_out_fname.c_str(), CFITSFile::create);
+    outf.SetImage(out);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked pixels
+    outf.WriteHistory("adbin: file is smoothed image");
+    add_history_list( &outf );
+  }{
+    CFITSFile outf(m_scale_fname.c_str(), CFITSFile::create);
+    outf.SetImage(scaleimg);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked pixels
+    outf.WriteHistory("adbin: file is kernel radius map");
+    add_history_list( &outf );
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  prog program(argc, argv);
+  program.run();
+  return 0;
+}
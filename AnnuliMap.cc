@@ -31,6 +31,8 @@
 #include <parammm/parammm.hh>
 #include <FITSFile.h>
 #include <FITSImage.h>
+#include "geommap.hh"
+#include "parallel.hh"
 #include "version.hh"
 
 using std::string;
@@ -40,16 +42,16 @@ class annuli_prog
 public:
   annuli_prog(int argc, char **argv);
 
-  void make_annuli();
-
   void process();
 
 private:
-  int m_xc, m_yc;        // x centre and y centre of annuli
+  double m_xc, m_yc;     // x centre and y centre of annuli
   double m_radius;       // annuli radii
-
-  CFITSImage m_outimage;
-  CFITSPosn m_posn;
+  double m_axis_ratio;   // minor/major axis ratio of elliptical annuli
+  double m_pa;           // position angle of major axis (deg)
+  int m_number_rays;     // split annuli into this many rays
+  double m_start_angle;  // angle for rays to start
+  int m_threads;         // number of threads (0 for all cpus)
 
   string m_binmap_fname;
   string m_input_fname;
@@ -59,6 +61,10 @@ private:
 annuli_prog::annuli_prog(int argc, char **argv)
   : m_xc(-1), m_yc(-1),
     m_radius(20.),
+    m_axis_ratio(1.), m_pa(0.),
+    m_number_rays(1),
+    m_start_angle(0.),
+    m_threads(0),
 
     m_binmap_fname("annuli_binmap.fits")
 {
@@ -70,17 +76,39 @@ annuli_prog::annuli_prog(int argc, char **argv)
 				      "(def annuli_binmap.fits)",
 				      "FILE"));
   params.add_switch( parammm::pswitch("xc", 'x',
-				      parammm::pint_opt(&m_xc),
+				      parammm::pdouble_opt(&m_xc),
 				      "X centre",
-				      "INT"));
+				      "VAL"));
   params.add_switch( parammm::pswitch("yc", 'y',
-				      parammm::pint_opt(&m_yc),
+				      parammm::pdouble_opt(&m_yc),
 				      "Y centre",
-				      "INT"));
+				      "VAL"));
   params.add_switch( parammm::pswitch("radius", 'r',
 				      parammm::pdouble_opt(&m_radius),
 				      "Annuli widths",
 				      "PIX"));
+  params.add_switch( parammm::pswitch("axisratio", 'q',
+				      parammm::pdouble_opt(&m_axis_ratio),
+				      "Minor/major axis ratio of "
+				      "elliptical annuli (def 1)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("pa", 'p',
+				      parammm::pdouble_opt(&m_pa),
+				      "Angle of major axis from x axis "
+				      "(def 0)",
+				      "DEG"));
+  params.add_switch( parammm::pswitch("norays", 'o',
+				      parammm::pint_opt(&m_number_rays),
+				      "Split each annulus into rays (def 1)",
+				      "INT"));
+  params.add_switch( parammm::pswitch("angle", 'a',
+				      parammm::pdouble_opt(&m_start_angle),
+				      "Start angle of rays",
+				      "DEG"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
 
   params.set_autohelp("Usage: AnnuliMap [OPTIONS] file\n"
 		      "Produces a annulus map on the same scale as input binmap\n"
@@ -98,48 +126,42 @@ annuli_prog::annuli_prog(int argc, char **argv)
     params.show_autohelp();
 
   m_input_fname = params.args()[0];
-}
-
-
-void annuli_prog::make_annuli()
-{
-  const int xw = m_outimage.GetXW(),
-    yw = m_outimage.GetYW();
 
-  for(int y=0; y<yw; ++y)
-    for(int x=0; x<xw; ++x) {
-
-      const int dx = x-m_xc, dy = y-m_yc;
-
-      const double radius = sqrt(dx*dx + dy*dy);
-
-      const int binno = int( radius / m_radius);
-
-      m_outimage.SetPixel(x, y, binno);
-    }
+  if(m_axis_ratio <= 0. || m_axis_ratio > 1.)
+    params.show_autohelp();
+  if(m_radius <= 0. || m_number_rays < 1)
+    params.show_autohelp();
+  if(m_threads <= 0)
+    m_threads = AdaptiveBin::default_threads();
 }
 
+
 void annuli_prog::process()
 {
+  int xw, yw;
+  CFITSPosn posn;
   {
-    CFITSFile f(m_input_fname.c_str(), CFITSFile::existingro);
-    CFITSImage temp = f.GetImage();
-    m_outimage.Resize(temp.GetXW(), temp.GetYW());
-    m_posn = f.GetPosn();
-
-    if(m_xc < 0 || m_yc < 0) {
-      m_xc = m_outimage.GetXW() / 2;
-      m_yc = m_outimage.GetYW() / 2;
-    }
+    CFITSFile f(m_input_fname.c_str(), CFITSFile::existinghdr);
+    f.ReadImageSize(&xw, &yw);
+    posn = f.GetPosn();
+  }
+
+  if(m_xc < 0 || m_yc < 0) {
+    m_xc = xw / 2;
+    m_yc = yw / 2;
   }
 
-  make_annuli();
+  AdaptiveBin::geom_binmap binmap(xw, yw, 0, m_threads);
+  if(m_number_rays > 1)
+    binmap.annuli_rays(m_xc, m_yc, m_radius, m_number_rays, m_start_angle,
+		       m_axis_ratio, m_pa);
+  else
+    binmap.annuli(m_xc, m_yc, m_radius, m_axis_ratio, m_pa);
 
   {
     CFITSFile f(m_binmap_fname.c_str(), CFITSFile::create);
-    f.SetImage(m_outimage);
-    f.SetPosn(m_posn);
-    f.WriteImage();
+    f.SetPosn(posn);
+    f.WriteIntImage(&binmap.bins()[0], xw, yw);
   }
 }
 
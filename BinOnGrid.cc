@@ -1,15 +1,18 @@
 // simple program to bin by a factor, but preserves image size
 
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <vector>
-#include <map>
 
 #include <parammm/parammm.hh>
-#include "../FITSFile.h"
+#include <FITSFile.h>
+#include "geommap.hh"
+#include "maskimage.hh"
+#include "parallel.hh"
 
 using std::string;
 using std::vector;
-using std::map;
 
 class binongrid {
 public:
@@ -20,11 +23,13 @@ public:
 private:
   string m_outfname, m_infname, m_maskfname;
   int m_binsize;
+  int m_threads;         // number of threads (0 for all cpus)
 };
 
 binongrid::binongrid(int argc, char **argv)
   : m_outfname("pixel.fits"),
-    m_binsize(1)
+    m_binsize(1),
+    m_threads(0)
 {
   parammm::param params(argc, argv);
   params.add_switch( parammm::pswitch("out", 'o',
@@ -42,8 +47,12 @@ binongrid::binongrid(int argc, char **argv)
 				      "INT"));
   params.add_switch( parammm::pswitch("mask", 'm',
 				      parammm::pstring_opt(&m_maskfname),
-				      "set mask file",
+				      "set mask file (pixels > 0 are masked)",
 				      "FILE"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
 
 
   params.set_autohelp("Usage: BinOnGrid [options] --in=in.fits\n"
@@ -58,8 +67,10 @@ binongrid::binongrid(int argc, char **argv)
   if(params.args().size() != 0)
     params.show_autohelp();
 
-  if( m_infname.size() == 0 )
+  if( m_infname.size() == 0 || m_binsize < 1 )
     params.show_autohelp();
+  if( m_threads <= 0 )
+    m_threads = AdaptiveBin::default_threads();
 }
 
 binongrid::~binongrid()
@@ -70,31 +81,21 @@ void binongrid::Run()
 {
   int xw, yw;
   {
-    CFITSFile infile(m_infname.c_str(), CFITSFile::existingro);
-    xw = infile.GetImage().GetXW();
-    yw = infile.GetImage().GetYW();
+    CFITSFile infile(m_infname.c_str(), CFITSFile::existinghdr);
+    infile.ReadImageSize(&xw, &yw);
   }
 
-  CFITSImage maskimage(xw, yw, 1.);
-  if( ! m_maskfname.empty() ) {
-    CFITSFile maskfile(m_maskfname.c_str(), CFITSFile::existingro);
-    maskimage = maskfile.GetImage();
-  }
-
-  int w = xw/m_binsize;
-  if( xw % m_binsize != 0 ) w++;
+  vector<bool> mask;
+  if( ! m_maskfname.empty() )
+    AdaptiveBin::read_mask(m_maskfname, xw, yw, false, &mask);
 
-  CFITSImage binpiximage(xw, yw);
-  for(int y=0; y<yw; y++)
-    for(int x=0; x<xw; x++) {
-      const int pix = (x/m_binsize)+(y/m_binsize)*w;
-      binpiximage.SetPixel(x, y, pix);
-    }
+  AdaptiveBin::geom_binmap binmap(xw, yw, mask.empty() ? 0 : &mask,
+				  m_threads);
+  binmap.grid(m_binsize);
 
   {
     CFITSFile outfile(m_outfname.c_str(), CFITSFile::create);
-    outfile.SetImage(binpiximage);
-    outfile.WriteImage();
+    outfile.WriteIntImage(&binmap.bins()[0], xw, yw);
   }
 }
 
@@ -0,0 +1,668 @@
+//      Adaptive Binning Program
+//      Contour binning - bins which follow surface brightness contours
+//      Routines for adaptively binning data
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// The image is first adaptively smoothed, each pixel taking the value
+// of the smallest box around it which reaches the smoothing error.
+// Bins are then grown from the brightest unbinned pixel in the
+// smoothed image. The neighbouring pixel with the smoothed value
+// closest to that of the starting pixel is added next, so bins follow
+// the surface brightness contours, until the bin reaches the
+// fractional error threshold. Bins which can't reach the threshold
+// are merged into their neighbours afterwards.
+
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <utility>
+#include <sstream>
+#include <cassert>
+#include <cmath>
+
+#include <parammm/parammm.hh>
+#include <FITSFile.h>
+
+#include "binmodule.hh"
+#include "maskimage.hh"
+#include "adaptsmooth.hh"
+#include "parallel.hh"
+#include "version.hh"
+
+using std::string;
+using std::sort;
+using std::vector;
+using std::pair;
+using std::make_pair;
+using std::cout;
+using std::cerr;
+using std::clog;
+using std::endl;
+using std::ostringstream;
+using std::sqrt;
+using std::fabs;
+
+namespace AdaptiveBin {
+
+  const int c_masked = -1;
+  const int c_unbinned = -2;
+
+  // a bin grown from a seed pixel
+  class contour_bin
+  {
+  public:
+    contour_bin(const binsums &sums)
+      : m_sums(sums), m_smoothtot(0.), m_good(false) {}
+
+    binsums m_sums;
+    double m_smoothtot;     // total of smoothed values of pixels
+    bool m_good;            // reached the threshold
+  };
+
+  class contour_binner
+  {
+  public:
+    contour_binner(binmodule *bm, double threshold,
+		   double smooth_threshold, double constrain,
+		   unsigned nothreads);
+    // bm is binning module (by which mode we're binning)
+    // threshold is fractional error threshold
+    // smooth_threshold is fractional error for the smoothing
+    // constrain is the geometric constraint (0 for none)
+    // nothreads is the number of threads to smooth with
+
+    ~contour_binner();
+
+    void bin(CFITSImage *out_image,
+	     CFITSImage *error_image,
+	     CFITSImage *binmap_image,
+	     CFITSImage *smoothed_image);
+
+    void set_mask(const vector<bool> &masked);
+    // pixels set in masked (one per pixel, row by row) are not binned
+
+  private:
+    void smooth();
+    void grow_bins();
+    void scrub_bins();
+    void paint_output();
+
+  private:
+    binmodule *m_binmod;                     // module to do the binning
+    double m_threshold;                      // threshold error value
+    double m_smooth_threshold;               // error for smoothing
+    double m_constrain;                      // geometric constraint
+    unsigned m_nothreads;                    // threads for smoothing
+    const int m_xw, m_yw;
+
+    vector<bool> m_masked;                   // pixels not to bin
+    vector<double> m_smoothed;               // smoothed image
+    vector<int> m_assign;                    // bin for each pixel
+    vector<contour_bin> m_bins;
+
+    CFITSImage m_out_image;                  // output binned image
+    CFITSImage m_error_image;                // output error image
+    CFITSImage m_output_binmap_image;        // output binmap
+    CFITSImage m_smoothed_image;             // output smoothed image
+  };
+
+  contour_binner::contour_binner(binmodule *bm, double threshold,
+				 double smooth_threshold, double constrain,
+				 unsigned nothreads)
+    : m_binmod(bm),
+      m_threshold(threshold),
+      m_smooth_threshold(smooth_threshold),
+      m_constrain(constrain),
+      m_nothreads(nothreads),
+      m_xw(bm->xw()), m_yw(bm->yw()),
+      m_masked(m_xw*m_yw, false),
+      m_smoothed(m_xw*m_yw, 0.),
+      m_assign(m_xw*m_yw, c_unbinned),
+      m_out_image(m_xw, m_yw),
+      m_error_image(m_xw, m_yw),
+      m_output_binmap_image(m_xw, m_yw),
+      m_smoothed_image(m_xw, m_yw)
+  {
+  }
+
+  contour_binner::~contour_binner()
+  {
+  }
+
+  void contour_binner::set_mask(const vector<bool> &masked)
+  {
+    // check mask is the same size as the image
+    assert( int(masked.size()) == m_xw*m_yw );
+
+    for(int i=0; i<m_xw*m_yw; ++i)
+      if( masked[i] )
+	{
+	  m_masked[i] = true;
+	  m_assign[i] = c_masked;
+	}
+  }
+
+  void contour_binner::bin(CFITSImage *out_image,
+			   CFITSImage *error_image,
+			   CFITSImage *binmap_image,
+			   CFITSImage *smoothed_image)
+  {
+    cout << "Smoothing" << endl;
+    smooth();
+    cout << "Growing bins" << endl;
+    grow_bins();
+    cout << "Scrubbing bins" << endl;
+    scrub_bins();
+    paint_output();
+
+    // return values
+    *out_image = m_out_image;
+    *error_image = m_error_image;
+    *binmap_image = m_output_binmap_image;
+    *smoothed_image = m_smoothed_image;
+  }
+
+  void contour_binner::smooth()
+  {
+    adaptive_smoother smoother(m_binmod, m_smooth_threshold,
+			       adaptive_smoother::box, &m_masked);
+    vector<double> scale;
+    smoother.smooth(&m_smoothed, &scale, m_nothreads);
+  }
+
+  void contour_binner::grow_bins()
+  {
+    const int nopix = m_xw*m_yw;
+
+    // order unmasked pixels by smoothed value, brightest first
+    vector< pair<double, int> > order;
+    for(int i=0; i<nopix; ++i)
+      if( m_assign[i] != c_masked )
+	order.push_back( make_pair(-m_smoothed[i], i) );
+    sort(order.begin(), order.end());
+
+    // pixels on the edge of the bin being grown, ordered by the
+    // difference of their smoothed value to the seed's
+    typedef pair<double, int> frontier_pixel;
+    std::priority_queue< frontier_pixel, vector<frontier_pixel>,
+			 std::greater<frontier_pixel> > frontier;
+    vector<int> queued(nopix, -1);
+
+    for(int i=0; i<int(order.size()); ++i)
+      {
+	const int seed = order[i].second;
+	if( m_assign[seed] != c_unbinned )
+	  continue;
+
+	const int binno = m_bins.size();
+	const double seedval = m_smoothed[seed];
+	contour_bin bin( m_binmod->newsums() );
+	double sumx = 0., sumy = 0.;
+
+	frontier.push( make_pair(0., seed) );
+	queued[seed] = binno;
+
+	while( ! frontier.empty() )
+	  {
+	    const int p = frontier.top().second;
+	    frontier.pop();
+
+	    const int px = p % m_xw, py = p / m_xw;
+
+	    // don't let the bin get too far from circular: pixels further
+	    // from the centroid than constrain times the radius of a
+	    // circle of the same area are skipped
+	    if( m_constrain > 0. && bin.m_sums.m_npix > 0 )
+	      {
+		const double n = bin.m_sums.m_npix;
+		const double dx = px - sumx/n, dy = py - sumy/n;
+		const double r2 = (n+1) / M_PI;
+		if( dx*dx+dy*dy > m_constrain*m_constrain*r2 )
+		  continue;
+	      }
+
+	    m_binmod->addpixel(&bin.m_sums, px, py);
+	    bin.m_smoothtot += m_smoothed[p];
+	    m_assign[p] = binno;
+	    sumx += px; sumy += py;
+
+	    const double error = m_binmod->fracerror(bin.m_sums, true);
+	    if( error > 0. && error <= m_threshold )
+	      {
+		bin.m_good = true;
+		break;
+	      }
+
+	    for(int dy=-1; dy<=1; ++dy)
+	      for(int dx=-1; dx<=1; ++dx)
+		{
+		  const int nx = px+dx, ny = py+dy;
+		  if( nx < 0 || ny < 0 || nx >= m_xw || ny >= m_yw )
+		    continue;
+		  const int n = nx+ny*m_xw;
+		  if( m_assign[n] != c_unbinned || queued[n] == binno )
+		    continue;
+
+		  queued[n] = binno;
+		  frontier.push( make_pair(fabs(m_smoothed[n]-seedval), n) );
+		}
+	  }
+
+	// leave the rest of the frontier unbinned
+	while( ! frontier.empty() )
+	  frontier.pop();
+
+	m_bins.push_back(bin);
+      }
+
+    cout << "Grew " << m_bins.size() << " bins" << endl;
+  }
+
+  void contour_binner::scrub_bins()
+  {
+    // merge bins which didn't reach the threshold into the
+    // neighbouring bin with the closest mean smoothed value
+
+    // lists of pixels in bins which failed
+    vector< vector<int> > failpix(m_bins.size());
+    for(int i=0; i<m_xw*m_yw; ++i)
+      {
+	const int b = m_assign[i];
+	if( b >= 0 && ! m_bins[b].m_good )
+	  failpix[b].push_back(i);
+      }
+
+    // worst bins first
+    vector< pair<double, int> > failed;
+    for(int b=0; b<int(m_bins.size()); ++b)
+      if( ! m_bins[b].m_good )
+	{
+	  const double error = m_binmod->fracerror(m_bins[b].m_sums, true);
+	  failed.push_back( make_pair(error > 0. ? -error : -1e30, b) );
+	}
+    sort(failed.begin(), failed.end());
+
+    int nomerged = 0;
+    bool changed = true;
+    while( changed )
+      {
+	changed = false;
+
+	for(int f=0; f<int(failed.size()); ++f)
+	  {
+	    const int b = failed[f].second;
+	    contour_bin &bin = m_bins[b];
+	    if( bin.m_good || bin.m_sums.m_npix == 0 )
+	      continue;
+
+	    // find neighbour with closest mean smoothed value
+	    const double mean = bin.m_smoothtot / bin.m_sums.m_npix;
+	    int best = -1;
+	    double bestdiff = 1e300;
+	    const vector<int> &pix = failpix[b];
+	    for(int i=0; i<int(pix.size()); ++i)
+	      {
+		const int px = pix[i] % m_xw, py = pix[i] / m_xw;
+		for(int dy=-1; dy<=1; ++dy)
+		  for(int dx=-1; dx<=1; ++dx)
+		    {
+		      const int nx = px+dx, ny = py+dy;
+		      if( nx < 0 || ny < 0 || nx >= m_xw || ny >= m_yw )
+			continue;
+		      const int nb = m_assign[nx+ny*m_xw];
+		      if( nb < 0 || nb == b )
+			continue;
+
+		      const contour_bin &other = m_bins[nb];
+		      const double diff =
+			fabs(other.m_smoothtot/other.m_sums.m_npix - mean);
+		      if( diff < bestdiff )
+			{
+			  bestdiff = diff;
+			  best = nb;
+			}
+		    }
+	      }
+
+	    if( best < 0 )
+	      continue;
+
+	    // move the pixels over
+	    contour_bin &target = m_bins[best];
+	    for(int i=0; i<int(pix.size()); ++i)
+	      m_assign[pix[i]] = best;
+	    target.m_sums.add(bin.m_sums);
+	    target.m_smoothtot += bin.m_smoothtot;
+	    if( ! target.m_good )
+	      {
+		failpix[best].insert(failpix[best].end(),
+				     pix.begin(), pix.end());
+		const double error =
+		  m_binmod->fracerror(target.m_sums, true);
+		target.m_good = error > 0. && error <= m_threshold;
+	      }
+
+	    bin.m_sums.clear();
+	    bin.m_smoothtot = 0.;
+	    failpix[b].clear();
+
+	    ++nomerged;
+	    changed = true;
+	  }
+      }
+
+    cout << "Merged " << nomerged << " bins" << endl;
+  }
+
+  void contour_binner::paint_output()
+  {
+    m_output_binmap_image.SetAll(-1.);
+    m_out_image.SetAll(-1.);
+    m_error_image.SetAll(-1.);
+    m_smoothed_image.SetAll(-1.);
+
+    // number the bins which still have pixels
+    const int nobins = m_bins.size();
+    vector<int> binno(nobins, -1);
+    vector<double> val(nobins), err(nobins);
+    int latest_bin_no = 0;
+    for(int b=0; b<nobins; ++b)
+      if( m_bins[b].m_sums.m_npix > 0 )
+	{
+	  binno[b] = latest_bin_no++;
+	  val[b] = m_binmod->value(m_bins[b].m_sums);
+	  err[b] = m_binmod->fracerror(m_bins[b].m_sums, false);
+	}
+
+    for(int y=0; y<m_yw; ++y)
+      for(int x=0; x<m_xw; ++x)
+	{
+	  const int i = x+y*m_xw;
+	  const int b = m_assign[i];
+	  if( b < 0 )
+	    continue;
+
+	  m_output_binmap_image.SetPixel(x, y, binno[b]);
+	  m_out_image.SetPixel(x, y, val[b]);
+	  m_error_image.SetPixel(x, y, err[b]);
+	  m_smoothed_image.SetPixel(x, y, m_smoothed[i]);
+	}
+
+    cout << "Made " << latest_bin_no << " bins" << endl;
+  }
+
+} // namespace
+
+
+///////////////////////////////////////////////////////////////////////
+// Program class
+
+class prog
+{
+public:
+  prog(int argc, char **argv);
+  ~prog();
+  void run();
+
+private:
+  void add_history_list(CFITSFile *file);
+
+public:
+  AdaptiveBin::binmodule *m_binmod;
+  double m_threshold;    // threshold value
+  double m_smooth_sn;    // signal to noise for smoothing
+  double m_constrain;    // geometric constraint value
+  int m_threads;         // number of threads (0 for all cpus)
+  string m_out_fname;    // output binned filename
+  string m_err_fname;    // output error filename
+  string m_binmap_fname; // output binmap filename
+  string m_smooth_fname; // output smoothed filename (optional)
+  string m_mask_fname;   // filename of the mask to use (optional)
+  string m_value;        // quantity to bin
+  bool m_verbose;        // display verbose information
+  bool m_invert_mask;    // invert 0 and 1 in mask
+
+  vector<string> m_history_list;
+};
+
+prog::prog(int argc, char **argv)
+  : m_binmod(0),
+    m_threshold(0.1),
+    m_smooth_sn(15.),
+    m_constrain(0.),
+    m_threads(0),
+    m_out_fname("contbin_out.fits"),
+    m_err_fname("contbin_err.fits"),
+    m_binmap_fname("contbin_binmap.fits"),
+    m_value("count(0)"),
+    m_verbose(false),
+    m_invert_mask(false)
+{
+  parammm::param params(argc, argv);
+  params.add_switch( parammm::pswitch("out", 'o',
+				      parammm::pstring_opt(&m_out_fname),
+				      "set out file (def contbin_out.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("error", 'e',
+				      parammm::pstring_opt(&m_err_fname),
+				      "set error out file (def contbin_err.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("binmap", 'n',
+				      parammm::pstring_opt(&m_binmap_fname),
+				      "set binmap out file (def contbin_binmap.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("smoothed", 0,
+				      parammm::pstring_opt(&m_smooth_fname),
+				      "set smoothed out file (optional)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("mask", 'm',
+				      parammm::pstring_opt(&m_mask_fname),
+				      "set input mask filename (optional)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("threshold", 't',
+				      parammm::pdouble_opt(&m_threshold),
+				      "set threshold fraction (def 10%)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("smoothsn", 's',
+				      parammm::pdouble_opt(&m_smooth_sn),
+				      "set smoothing signal:noise (def 15)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("constrain", 'c',
+				      parammm::pdouble_opt(&m_constrain),
+				      "set geometric constraint (def none, "
+				      "try 2)", "VAL"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("value", 'v',
+				      parammm::pstring_opt(&m_value),
+				      "set output value (eg count(0), "
+				      "ratio(1,2))", "STR") );
+  params.add_switch( parammm::pswitch("invertmask", 0,
+				      parammm::pbool_noopt(&m_invert_mask),
+				      "invert input mask image",
+				      ""));
+  params.add_switch( parammm::pswitch("verbose", 0,
+				      parammm::pbool_noopt(&m_verbose),
+				      "display more information",
+				      ""));
+
+  params.set_autohelp("Usage: ContourBin [OPTIONS] file bg=count...\n"
+		      "Bins a set of images following surface brightness "
+		      "contours\n"
+		      "Written by Jeremy Sanders, 2000, 2001.",
+		      "Report bugs to <jss@ast.cam.ac.uk>");
+  params.enable_autohelp();
+  params.enable_autoversion(c_adbin_version,
+			    "Jeremy Sanders",
+			    "Licenced under the GPL - see the file COPYING");
+  params.enable_at_expansion();
+
+  params.interpret_and_catch();
+
+  if(params.args().size() < 1 || m_smooth_sn <= 0.)
+    params.show_autohelp();
+
+  if(m_threads <= 0)
+    m_threads = AdaptiveBin::default_threads();
+
+  try {
+    // select external if specified
+    const string first8(m_value, 0, 8);
+    if( first8 == "external" )
+      m_binmod = new AdaptiveBin::external_binmodule(params.args());
+    else
+      m_binmod = new AdaptiveBin::ratio_binmodule(params.args());
+    m_binmod->selectvalue(m_value);
+  }
+  catch(AdaptiveBin::invalidargs_exception e) {
+    clog << "Invalid files listed\n\n";
+    params.show_autohelp();
+  }
+  catch(AdaptiveBin::invalidvalue_exception e) {
+    clog << "Invalid output value\n\n";
+    params.show_autohelp();
+  }
+
+  cout << "Using value "
+       << m_binmod->get_value_descr() << endl;
+
+  {
+    // stuff to write into history in fits output files
+    m_history_list.push_back(string("file created by ContourBin v. ")
+			     + c_adbin_version);
+
+    for(int i = 0; i<int(params.args().size()); ++i) {
+      ostringstream o;
+      o << "arg " << i << ": " << params.args()[i];
+      m_history_list.push_back( o.str() );
+    }
+
+    m_history_list.push_back( string("output image: ") + m_out_fname );
+    m_history_list.push_back( string("error map: ") + m_err_fname );
+    m_history_list.push_back( string("bin map: ") + m_binmap_fname );
+
+    m_history_list.push_back( string("mask: ") + m_mask_fname );
+    m_history_list.push_back( string("value: ") + m_binmod->get_value_descr() );
+
+    {
+      ostringstream o;
+      o << "threshold: " << m_threshold;
+      m_history_list.push_back( o.str() );
+    }{
+      ostringstream o;
+      o << "smoothsn: " << m_smooth_sn;
+      m_history_list.push_back( o.str() );
+    }{
+      ostringstream o;
+      o << "constrain: " << m_constrain;
+      m_history_list.push_back( o.str() );
+    }
+  } // end history comments
+
+  // write history to screen if verbose option is on
+  if(m_verbose) {
+    cout << "\nHeader lines written to output files:\n";
+    for(int i=0; i<int(m_history_list.size()); ++i)
+      cout << m_history_list[i] << endl;
+    cout << endl;
+  }
+}
+
+prog::~prog()
+{
+  if(m_binmod != 0)
+    delete m_binmod;
+}
+
+void prog::add_history_list(CFITSFile *file)
+{
+  const int no = m_history_list.size();
+
+  for(int i=0; i<no; ++i) {
+    const string line = "adbin: " + m_history_list[i];
+    file -> WriteHistory(line.c_str());
+  }
+}
+
+void prog::run()
+{
+  CFITSImage out, err, pixel, smoothed;
+  AdaptiveBin::contour_binner b(m_binmod, m_threshold, 1./m_smooth_sn,
+				m_constrain, m_threads);
+
+  if( ! m_mask_fname.empty() ) {
+    vector<bool> masked;
+    AdaptiveBin::read_mask(m_mask_fname, m_binmod->xw(), m_binmod->yw(),
+			   m_invert_mask, &masked);
+    b.set_mask(masked);
+  }
+
+  b.bin(&out, &err, &pixel, &smoothed);
+
+  CFITSPosn posn;
+  m_binmod -> getposn(&posn);
+
+  {
+    CFITSFile outf(m_out_fname.c_str(), CFITSFile::create);
+    outf.SetImage(out);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked bins
+    outf.WriteHistory("adbin: file is output image");
+    add_history_list( &outf );
+  }{
+    CFITSFile outf(m_err_fname.c_str(), CFITSFile::create);
+    outf.SetImage(err);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked bins
+    outf.WriteHistory("adbin: file is error map");
+    add_history_list( &outf );
+  }{
+    CFITSFile outf(m_binmap_fname.c_str(), CFITSFile::create);
+    outf.SetImage(pixel);
+    outf.SetPosn(posn);
+    outf.WriteImage();
+    outf.WriteHistory("adbin: file is bin map");
+    add_history_list( &outf );
+  }
+
+  if( ! m_smooth_fname.empty() ) {
+    CFITSFile outf(m_smooth_fname.c_str(), CFITSFile::create);
+    outf.SetImage(smoothed);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked pixels
+    outf.WriteHistory("adbin: file is smoothed image");
+    add_history_list( &outf );
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  prog program(argc, argv);
+  program.run();
+  return 0;
+}
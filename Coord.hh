@@ -11,7 +11,7 @@ namespace AdaptiveBin {
   public:
     CCoord(int x, int y);
     CCoord();
-    virtual ~CCoord();
+    ~CCoord();
     CCoord operator +(const CCoord &other) const;
 
     int m_x, m_y;
@@ -89,6 +89,16 @@ void CFITSFile::OpenFile(const char *fileName, COpenMode openMode)
     CheckStatus("Opening file (RW)");
     ReadImage();
     break;
+  case existinghdr:
+    cf_comment();
+    printf("Opening %s (header)\n", m_fileName);
+    m_FITSMode = READONLY;
+    m_previousWritten = 1;
+    // move past an empty primary HDU, as in tile-compressed files
+    fits_open_image(&m_file, m_fileName, m_FITSMode, &m_status);
+    CheckStatus("Opening file (header)");
+    m_posnImage.ReadFITSHeader(*this);
+    break;
   case create:
     cf_comment();
     printf("Creating %s\n", m_fileName);
@@ -227,6 +237,38 @@ void CFITSFile::ReadImage()
   m_posnImage.ReadFITSHeader(*this);
 }
 
+void CFITSFile::ReadImageSize(int *xw, int *yw)
+{
+  // ask fitsio rather than reading NAXISn, as in a tile-compressed
+  // image those describe the table holding the tiles
+  int naxis = 0;
+  fits_get_img_dim(m_file, &naxis, &m_status);
+  CheckStatus("Reading image dimensions");
+  if( naxis < 2 ) {
+    fprintf(stderr, "*   CFITSFile::ReadImageSize(): no image data found\n");
+    exit(-1);
+  }
+
+  long axes[2];
+  fits_get_img_size(m_file, 2, axes, &m_status);
+  CheckStatus("Reading image size");
+
+  *xw = int(axes[0]);
+  *yw = int(axes[1]);
+}
+
+void CFITSFile::ReadImageRows(int y1, int norows, CFloatType *data)
+{
+  int xw, yw;
+  ReadImageSize(&xw, &yw);
+
+  int isnull;
+  CFloatType anull = CNullValue;
+  fits_read_img(m_file, CFITSFloatType, long(y1)*long(xw)+1,
+		long(norows)*long(xw), &anull, data, &isnull, &m_status);
+  CheckStatus("Reading image rows");
+}
+
 void CFITSFile::ReadImageInclNull(CFloatType nullval)
 {
   int xw, yw;
@@ -315,6 +357,62 @@ void CFITSFile::WriteImageInclNull(CFloatType nullval)
   m_previousWritten = 1;
 }
 
+void CFITSFile::SetTileCompression(int compress)
+{
+  fits_set_compression_type(m_file, compress ? RICE_1 : 0, &m_status);
+  CheckStatus("Setting compression");
+}
+
+void CFITSFile::WriteIntImage(const int *data, int xw, int yw)
+{
+  WriteTypedImage(LONG_IMG, TINT, data, xw, yw);
+}
+
+void CFITSFile::WriteByteImage(const unsigned char *data, int xw, int yw)
+{
+  WriteTypedImage(BYTE_IMG, TBYTE, data, xw, yw);
+}
+
+void CFITSFile::WriteImageCube(const CFloatType *data, int xw, int yw, int zw)
+{
+  WriteTypedImage(CFITSDataFormat, CFITSFloatType, data, xw, yw, zw);
+}
+
+void CFITSFile::WriteTypedImage(int bitpix, int datatype, const void *data,
+				int xw, int yw, int zw)
+{
+  int bp = bitpix;
+  const int naxis = zw > 1 ? 3 : 2;
+
+  cf_comment();
+  if(naxis == 3)
+    printf(" Writing %i bit cube, size %i x %i x %i\n", bitpix, xw, yw, zw);
+  else
+    printf(" Writing %i bit image, size %i x %i\n", bitpix, xw, yw);
+
+  if(m_previousWritten) {
+    UpdateKey("NAXIS", tint, &naxis, "Number of axes");
+    UpdateKey("NAXIS1", tint, &xw, "X Width");
+    UpdateKey("NAXIS2", tint, &yw, "Y Width");
+    if(naxis == 3)
+      UpdateKey("NAXIS3", tint, &zw, "Number of planes");
+    UpdateKey("BITPIX", tint, &bp, "Number of bits per data pixel");
+  } else {
+    long axes[3];
+    axes[0] = xw; axes[1] = yw; axes[2] = zw;
+    fits_create_img(m_file, bp, naxis, axes, &m_status);
+    CheckStatus("Writing image header");
+  }
+
+  fits_write_img(m_file, datatype, 1, long(xw)*long(yw)*long(zw),
+		 (void*)data, &m_status);
+  CheckStatus("Writing image");
+
+  m_posnImage.WriteFITSHeader(*this);
+
+  m_previousWritten = 1;
+}
+
 void CFITSFile::SetImage(const CFITSImage &copy)
 {
   m_image = copy;
@@ -32,10 +32,11 @@
 class CFITSFile
 {
 public:                  // public data types
-  enum COpenMode {existingro, existing, create};
+  enum COpenMode {existingro, existing, create, existinghdr};
     // modes: existing file, read-only
     //        existing file, read-write
     //        create new file
+    //        existing file, read-only, header and position only
   enum CDataType {tint, tfloat, tstring};
 
 public:                  // public methods
@@ -58,12 +59,26 @@ public:                  // public methods
 
   void ReadImage();
     // (re)reads the image from the file into m_image
+  void ReadImageSize(int *xw, int *yw);
+    // reads the image size from the header, without reading the image
+  void ReadImageRows(int y1, int norows, CFloatType *data);
+    // reads rows y1 <= y < y1+norows of the image into data,
+    // without reading the rest of the image
   void ReadImageInclNull(CFloatType nullval = CNullValue);
     // does above, but sets NANs to nullval
   void WriteImage();
     // updates the image in the file
   void WriteImageInclNull(CFloatType nullval = CNullValue);
     // write NULLs as NULLs
+  void WriteIntImage(const int *data, int xw, int yw);
+    // writes xw*yw ints (row by row) as a 32 bit integer image
+    // instead of m_image
+  void WriteByteImage(const unsigned char *data, int xw, int yw);
+    // writes xw*yw bytes (row by row) as an 8 bit image
+  void WriteImageCube(const CFloatType *data, int xw, int yw, int zw);
+    // writes zw planes of xw*yw pixels (plane by plane) as a cube
+  void SetTileCompression(int compress = 1);
+    // if compress, images written after this are tile-compressed
 
   void WriteHistory(const char *hist);
     // append hist as line in history
@@ -81,6 +96,10 @@ public:
 private: // private methods
   int GetFITSDataType(CDataType d);
     // convert CDataType to fitsio int type
+  void WriteTypedImage(int bitpix, int datatype, const void *data,
+		       int xw, int yw, int zw = 1);
+    // write data of fitsio type datatype as an image of bitpix
+    // (a cube if zw > 1)
 
 private: // private data
   fitsfile *m_file;
@@ -8,18 +8,38 @@
 
 // supported shapes
 // [+/~]rectangle(x1,y1,x2,y2) [+/~]circle(xc,yc,rad)
-// coordinates are pixels
+// [+/~]ellipse(xc,yc,rx,ry[,angle]) [+/~]box(xc,yc,w,h[,angle])
+// [+/~]annulus(xc,yc,rin,rout) [+/~]polygon(x1,y1,x2,y2,x3,y3,...)
+// coordinates are pixels, and angles are degrees anticlockwise
+// from the x axis
+
+// shapes can also be read from a DS9 or CIAO region file (--regions)
+// in image or physical coordinates, included shapes being masked and
+// excluded (-) ones unmasked
+
+// each shape is drawn a row at a time, as the spans of pixels in the
+// row whose centres are inside the shape, so drawing only costs time
+// in proportion to the pixels covered
+
+// the mask is written as an 8 bit image (optionally tile-compressed),
+// and only the header of the input image is read
 
 #include <vector>
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <fstream>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <utility>
 #include <assert.h>
 #include <FITSFile.h>
 
 #include <parammm/parammm.hh>
 
+#include "parallel.hh"
 #include "version.hh"
 
 using std::string;
@@ -30,9 +50,14 @@ using std::istringstream;
 using std::cout;
 using std::cerr;
 using std::endl;
+using std::min;
+using std::max;
+using std::pair;
+using std::make_pair;
 
 typedef vector<string> str_vec;
 typedef vector<double> double_vec;
+typedef vector< pair<int,int> > span_vec;   // x1 <= x < x2
 
 class mask
 {
@@ -42,9 +67,17 @@ public:
 
   void set_args(const str_vec &args);
   virtual string get_description() = 0;
-  virtual void draw(CFITSImage *image) = 0;
   virtual void interpret_args(const double_vec &args);
 
+  virtual void get_rows(int *y1, int *y2) const = 0;
+  // rows y1 <= y <= y2 the shape may cover
+  virtual void add_spans(int y, span_vec *spans) const = 0;
+  // add the spans of pixels in row y whose centres are inside the
+  // shape (not clipped to the image)
+
+  void draw(unsigned char *buffer, int xw, int yw, int ylo, int yhi) const;
+  // draw the shape into the xw*yw buffer in rows ylo <= y <= yhi
+
 protected:
   const double m_val;
 };
@@ -82,15 +115,87 @@ void mask::interpret_args(const double_vec &args)
 {
 }
 
+void mask::draw(unsigned char *buffer, int xw, int yw,
+		int ylo, int yhi) const
+{
+  const unsigned char val = m_val > 0. ? 1 : 0;
+
+  int y1, y2;
+  get_rows(&y1, &y2);
+  y1 = max( y1, max(ylo, 0) );
+  y2 = min( y2, min(yhi, yw-1) );
+
+  span_vec spans;
+  for(int y=y1; y<=y2; ++y) {
+    spans.clear();
+    add_spans(y, &spans);
+
+    for(int i=0; i<int(spans.size()); ++i) {
+      const int x1 = max(spans[i].first, 0);
+      const int x2 = min(spans[i].second, xw);
+      for(int x=x1; x<x2; ++x)
+	buffer[x+y*xw] = val;
+    }
+  }
+}
+
+namespace {
+
+  // the span of pixels in a row with test(x) true, starting from a
+  // guess at its ends from solving the boundary of the shape
+  // the ends are checked with the exact test
+  template<class T> void fix_span(const T &test, double xlo, double xhi,
+				  span_vec *spans)
+  {
+    int x1 = int( std::floor(xlo) ), x2 = int( std::ceil(xhi) );
+    while( test(x1-1) ) --x1;
+    while( x1 <= x2 && ! test(x1) ) ++x1;
+    while( test(x2+1) ) ++x2;
+    while( x2 >= x1 && ! test(x2) ) --x2;
+
+    if( x1 <= x2 )
+      spans->push_back( make_pair(x1, x2+1) );
+  }
+
+  // is a pixel within radius of a centre?
+  class in_circle
+  {
+  public:
+    in_circle(double xc, double dy, double radius)
+      : m_xc(xc), m_dysqd(dy*dy), m_radius(radius) {}
+    bool operator()(int x) const
+    {
+      const double dx = x - m_xc;
+      return sqrt( dx*dx + m_dysqd ) < m_radius;
+    }
+  private:
+    double m_xc, m_dysqd, m_radius;
+  };
+
+  // pixels of row y within radius of (xc, yc)
+  void circle_span(double xc, double yc, double radius, int y,
+		   span_vec *spans)
+  {
+    const double dy = y - yc;
+    if( std::fabs(dy) >= radius )
+      return;
+
+    const double half = sqrt( radius*radius - dy*dy );
+    fix_span( in_circle(xc, dy, radius), xc-half, xc+half, spans );
+  }
+
+}
+
 ////////////////////////////////////////////////////////
 
 class rectangle_mask : public mask
 {
 public:
   rectangle_mask(double val);
-  void draw(CFITSImage *image);
   string get_description();
   void interpret_args(const double_vec &args);
+  void get_rows(int *y1, int *y2) const;
+  void add_spans(int y, span_vec *spans) const;
 
 private:
   int m_x1, m_y1, m_x2, m_y2;
@@ -101,11 +206,15 @@ rectangle_mask::rectangle_mask(double val)
 {
 }
 
-void rectangle_mask::draw(CFITSImage *image)
+void rectangle_mask::get_rows(int *y1, int *y2) const
+{
+  *y1 = m_y1; *y2 = m_y2;
+}
+
+void rectangle_mask::add_spans(int y, span_vec *spans) const
 {
-  for(int y=m_y1; y<=m_y2; ++y)
-    for(int x=m_x1; x<=m_x2; ++x)
-      image->SetPixelBounded(x, y, m_val);
+  if( m_x1 <= m_x2 )
+    spans->push_back( make_pair(m_x1, m_x2+1) );
 }
 
 string rectangle_mask::get_description()
@@ -134,9 +243,10 @@ class circle_mask : public mask
 {
 public:
   circle_mask(double val);
-  void draw(CFITSImage *image);
   void interpret_args(const double_vec &args);
   string get_description();
+  void get_rows(int *y1, int *y2) const;
+  void add_spans(int y, span_vec *spans) const;
 
 private:
   double m_xc, m_yc;
@@ -158,21 +268,15 @@ string circle_mask::get_description()
   return o.str();
 }
 
-void circle_mask::draw(CFITSImage *image)
+void circle_mask::get_rows(int *y1, int *y2) const
 {
-  const int xw = image->GetXW(), yw = image->GetYW();
-
-  // crap algorithm, but it works
-  for(int y=0; y<yw; ++y)
-    for(int x=0; x<xw; ++x) {
-      const double dx = x - m_xc, dy = y - m_yc;
-
-      // calc distance, and see how far away it is 
-      const double dist = sqrt( dx*dx + dy*dy );
-      if(dist < m_radius)
-	image->SetPixel(x, y, m_val);
-    }
+  *y1 = int( std::floor(m_yc - m_radius) );
+  *y2 = int( std::ceil(m_yc + m_radius) );
+}
 
+void circle_mask::add_spans(int y, span_vec *spans) const
+{
+  circle_span(m_xc, m_yc, m_radius, y, spans);
 }
 
 void circle_mask::interpret_args(const double_vec &args)
@@ -186,10 +290,512 @@ void circle_mask::interpret_args(const double_vec &args)
   m_radius = args[2];
 }
 
+
+class ellipse_mask : public mask
+{
+public:
+  ellipse_mask(double val);
+  void interpret_args(const double_vec &args);
+  string get_description();
+  void get_rows(int *y1, int *y2) const;
+  void add_spans(int y, span_vec *spans) const;
+
+  bool inside(int x, double dy) const;
+
+private:
+  double m_xc, m_yc;
+  double m_rx, m_ry;      // semi-axes along and across angle
+  double m_angle;
+  double m_cos, m_sin;
+};
+
+namespace {
+  class in_ellipse
+  {
+  public:
+    in_ellipse(const ellipse_mask &e, double dy) : m_e(e), m_dy(dy) {}
+    bool operator()(int x) const { return m_e.inside(x, m_dy); }
+  private:
+    const ellipse_mask &m_e;
+    double m_dy;
+  };
+}
+
+ellipse_mask::ellipse_mask(double val)
+  : mask(val)
+{
+}
+
+string ellipse_mask::get_description()
+{
+  ostringstream o;
+  if( fabs(m_val) < 1e-8 ) o << '~'; else o << '+';
+
+  o << "ellipse(" << m_xc << ',' << m_yc << ',' << m_rx << ','
+    << m_ry << ',' << m_angle << ')' << '\0';
+  return o.str();
+}
+
+void ellipse_mask::interpret_args(const double_vec &args)
+{
+  if( args.size() != 4 && args.size() != 5 ) {
+    cerr << "4 or 5 arguments required for ellipse shape. Aborting\n";
+    exit(1);
+  }
+
+  m_xc = args[0]; m_yc = args[1];
+  m_rx = args[2]; m_ry = args[3];
+  m_angle = args.size() == 5 ? args[4] : 0.;
+  m_cos = std::cos(m_angle * M_PI / 180.);
+  m_sin = std::sin(m_angle * M_PI / 180.);
+}
+
+bool ellipse_mask::inside(int x, double dy) const
+{
+  const double dx = x - m_xc;
+  const double u = (dx*m_cos + dy*m_sin) / m_rx;
+  const double v = (dy*m_cos - dx*m_sin) / m_ry;
+  return u*u + v*v < 1.;
+}
+
+void ellipse_mask::get_rows(int *y1, int *y2) const
+{
+  const double ext = sqrt( m_rx*m_rx*m_sin*m_sin + m_ry*m_ry*m_cos*m_cos );
+  *y1 = int( std::floor(m_yc - ext) );
+  *y2 = int( std::ceil(m_yc + ext) );
+}
+
+void ellipse_mask::add_spans(int y, span_vec *spans) const
+{
+  // inside is a*dx^2 + b*dx + c < 0
+  const double dy = y - m_yc;
+  const double irx2 = 1./(m_rx*m_rx), iry2 = 1./(m_ry*m_ry);
+  const double a = m_cos*m_cos*irx2 + m_sin*m_sin*iry2;
+  const double b = 2.*dy*m_cos*m_sin*(irx2 - iry2);
+  const double c = dy*dy*(m_sin*m_sin*irx2 + m_cos*m_cos*iry2) - 1.;
+
+  const double disc = b*b - 4.*a*c;
+  if( disc <= 0. )
+    return;
+
+  const double root = sqrt(disc);
+  fix_span( in_ellipse(*this, dy), m_xc + (-b-root)/(2.*a),
+	    m_xc + (-b+root)/(2.*a), spans );
+}
+
+
+class annulus_mask : public mask
+{
+public:
+  annulus_mask(double val);
+  void interpret_args(const double_vec &args);
+  string get_description();
+  void get_rows(int *y1, int *y2) const;
+  void add_spans(int y, span_vec *spans) const;
+
+private:
+  double m_xc, m_yc;
+  double m_inner, m_outer;
+};
+
+annulus_mask::annulus_mask(double val)
+  : mask(val)
+{
+}
+
+string annulus_mask::get_description()
+{
+  ostringstream o;
+  if( fabs(m_val) < 1e-8 ) o << '~'; else o << '+';
+
+  o << "annulus(" << m_xc << ',' << m_yc << ',' << m_inner << ','
+    << m_outer << ')' << '\0';
+  return o.str();
+}
+
+void annulus_mask::interpret_args(const double_vec &args)
+{
+  if( args.size() != 4 ) {
+    cerr << "4 arguments required for annulus shape. Aborting\n";
+    exit(1);
+  }
+
+  m_xc = args[0]; m_yc = args[1];
+  m_inner = args[2]; m_outer = args[3];
+}
+
+void annulus_mask::get_rows(int *y1, int *y2) const
+{
+  *y1 = int( std::floor(m_yc - m_outer) );
+  *y2 = int( std::ceil(m_yc + m_outer) );
+}
+
+// pixels inside the outer circle, but not the inner one
+void annulus_mask::add_spans(int y, span_vec *spans) const
+{
+  span_vec outer, inner;
+  circle_span(m_xc, m_yc, m_outer, y, &outer);
+  if( outer.empty() )
+    return;
+  circle_span(m_xc, m_yc, m_inner, y, &inner);
+
+  if( inner.empty() ) {
+    spans->push_back(outer[0]);
+    return;
+  }
+
+  if( outer[0].first < inner[0].first )
+    spans->push_back( make_pair(outer[0].first, inner[0].first) );
+  if( inner[0].second < outer[0].second )
+    spans->push_back( make_pair(inner[0].second, outer[0].second) );
+}
+
+
+// pixels inside are found from where the edges cross each row, using
+// the even-odd rule
+class polygon_mask : public mask
+{
+public:
+  polygon_mask(double val);
+  void interpret_args(const double_vec &args);
+  string get_description();
+  void get_rows(int *y1, int *y2) const;
+  void add_spans(int y, span_vec *spans) const;
+
+protected:
+  double_vec m_xs, m_ys;   // vertices
+};
+
+polygon_mask::polygon_mask(double val)
+  : mask(val)
+{
+}
+
+string polygon_mask::get_description()
+{
+  ostringstream o;
+  if( fabs(m_val) < 1e-8 ) o << '~'; else o << '+';
+
+  o << "polygon(";
+  for(int i=0; i<int(m_xs.size()); ++i) {
+    if( i != 0 ) o << ',';
+    o << m_xs[i] << ',' << m_ys[i];
+  }
+  o << ')' << '\0';
+  return o.str();
+}
+
+void polygon_mask::interpret_args(const double_vec &args)
+{
+  if( args.size() < 6 || args.size() % 2 != 0 ) {
+    cerr << "At least 3 pairs of coordinates required for polygon "
+      "shape. Aborting\n";
+    exit(1);
+  }
+
+  m_xs.clear(); m_ys.clear();
+  for(int i=0; i<int(args.size()); i += 2) {
+    m_xs.push_back( args[i] );
+    m_ys.push_back( args[i+1] );
+  }
+}
+
+void polygon_mask::get_rows(int *y1, int *y2) const
+{
+  const double ymin = *std::min_element(m_ys.begin(), m_ys.end());
+  const double ymax = *std::max_element(m_ys.begin(), m_ys.end());
+  *y1 = int( std::floor(ymin) );
+  *y2 = int( std::ceil(ymax) );
+}
+
+void polygon_mask::add_spans(int y, span_vec *spans) const
+{
+  // x positions where edges cross the row through the pixel centres
+  double_vec cross;
+  const int n = m_xs.size();
+  for(int i=0; i<n; ++i) {
+    const int j = (i+1) % n;
+    const double y1 = m_ys[i], y2 = m_ys[j];
+    if( (y1 <= y && y < y2) || (y2 <= y && y < y1) )
+      cross.push_back( m_xs[i] + (y-y1)*(m_xs[j]-m_xs[i])/(y2-y1) );
+  }
+  std::sort(cross.begin(), cross.end());
+
+  // pixels with centres in [cross[k], cross[k+1]) are inside
+  for(int k=0; k+1<int(cross.size()); k += 2) {
+    const int x1 = int( std::ceil(cross[k]) );
+    const int x2 = int( std::ceil(cross[k+1]) );
+    if( x1 < x2 )
+      spans->push_back( make_pair(x1, x2) );
+  }
+}
+
+
+// a rotated box is a polygon with its corners
+class box_mask : public polygon_mask
+{
+public:
+  box_mask(double val);
+  void interpret_args(const double_vec &args);
+  string get_description();
+
+private:
+  double m_xc, m_yc;
+  double m_width, m_height;
+  double m_angle;
+};
+
+box_mask::box_mask(double val)
+  : polygon_mask(val)
+{
+}
+
+string box_mask::get_description()
+{
+  ostringstream o;
+  if( fabs(m_val) < 1e-8 ) o << '~'; else o << '+';
+
+  o << "box(" << m_xc << ',' << m_yc << ',' << m_width << ','
+    << m_height << ',' << m_angle << ')' << '\0';
+  return o.str();
+}
+
+void box_mask::interpret_args(const double_vec &args)
+{
+  if( args.size() != 4 && args.size() != 5 ) {
+    cerr << "4 or 5 arguments required for box shape. Aborting\n";
+    exit(1);
+  }
+
+  m_xc = args[0]; m_yc = args[1];
+  m_width = args[2]; m_height = args[3];
+  m_angle = args.size() == 5 ? args[4] : 0.;
+
+  const double c = std::cos(m_angle * M_PI / 180.);
+  const double s = std::sin(m_angle * M_PI / 180.);
+  const double hw = 0.5*m_width, hh = 0.5*m_height;
+  const double corners[4][2] = { {-hw, -hh}, {hw, -hh}, {hw, hh},
+				 {-hw, hh} };
+
+  m_xs.clear(); m_ys.clear();
+  for(int i=0; i<4; ++i) {
+    m_xs.push_back( m_xc + corners[i][0]*c - corners[i][1]*s );
+    m_ys.push_back( m_yc + corners[i][0]*s + corners[i][1]*c );
+  }
+}
+
 ////////////////////////////////////////////////////////////////
 
 typedef vector<mask*> mask_vec;
 
+const int c_no_mask_names = 6;
+const char *c_mask_names[c_no_mask_names] = {"rectangle", "circle",
+					      "ellipse", "box",
+					      "annulus", "polygon"};
+
+// make a mask of a type in c_mask_names
+mask *make_mask(int mask_id, double val)
+{
+  switch( mask_id ) {
+  case 0: return new rectangle_mask( val );
+  case 1: return new circle_mask( val );
+  case 2: return new ellipse_mask( val );
+  case 3: return new box_mask( val );
+  case 4: return new annulus_mask( val );
+  case 5: return new polygon_mask( val );
+  default:
+    assert(false);
+    return 0;
+  }
+}
+
+// reads shapes from DS9 or CIAO region files
+// shapes are converted to the 0-based pixel coordinates used by the
+// masks, from image coordinates or from physical coordinates using the
+// LTV and LTM keywords of the image
+class region_reader
+{
+public:
+  region_reader(double ltv1, double ltv2, double ltm);
+
+  void read(const string &filename, mask_vec *masks);
+
+private:
+  void parse_shape(const char *text, const string &filename, int lineno,
+		   mask_vec *masks);
+  void to_pixels(double_vec *pos) const;
+
+private:
+  double m_ltv1, m_ltv2, m_ltm;
+  bool m_physical;
+};
+
+region_reader::region_reader(double ltv1, double ltv2, double ltm)
+  : m_ltv1(ltv1), m_ltv2(ltv2), m_ltm(ltm),
+    m_physical(true)
+{
+}
+
+void region_reader::read(const string &filename, mask_vec *masks)
+{
+  std::ifstream in(filename.c_str());
+  if( ! in ) {
+    cerr << "Unable to open region file " << filename << ". Aborting\n";
+    exit(1);
+  }
+
+  string line;
+  int lineno = 0;
+  while( std::getline(in, line) ) {
+    ++lineno;
+
+    // drop comments, which also hold the DS9 properties of shapes
+    const string::size_type hash = line.find('#');
+    if( hash != string::npos )
+      line.erase(hash);
+
+    // there can be several shapes on a line
+    string::size_type start = 0;
+    while( start < line.size() ) {
+      string::size_type end = line.find(';', start);
+      if( end == string::npos )
+	end = line.size();
+
+      string part = line.substr(start, end-start);
+      const string::size_type first = part.find_first_not_of(" \t\r");
+      if( first != string::npos ) {
+	part.erase(0, first);
+	part.erase( part.find_last_not_of(" \t\r")+1 );
+
+	if( part == "image" )
+	  m_physical = false;
+	else if( part == "physical" )
+	  m_physical = true;
+	else if( part.compare(0, 6, "global") == 0 ||
+		 part.compare(0, 6, "Region") == 0 )
+	  ;
+	else
+	  parse_shape(part.c_str(), filename, lineno, masks);
+      }
+
+      start = end+1;
+    }
+  }
+}
+
+void region_reader::parse_shape(const char *text, const string &filename,
+				int lineno, mask_vec *masks)
+{
+  // include (masked) or exclude (unmasked)
+  double val = 1.;
+  if( *text == '-' || *text == '!' ) {
+    val = 0.;
+    ++text;
+  } else if( *text == '+' )
+    ++text;
+
+  const char *bracket = std::strchr(text, '(');
+  if( bracket == 0 ) {
+    cerr << filename << ':' << lineno << ": unsupported line \""
+	 << text << "\". Aborting\n";
+    exit(1);
+  }
+  string name(text, bracket-text);
+  while( ! name.empty() && (name[name.size()-1] == ' ' ||
+			    name[name.size()-1] == '\t') )
+    name.erase(name.size()-1);
+
+  // read the numbers
+  double_vec args;
+  const char *p = bracket+1;
+  for(;;) {
+    while( *p == ' ' || *p == '\t' || *p == ',' )
+      ++p;
+    if( *p == ')' || *p == 0 )
+      break;
+
+    char *end;
+    const double v = std::strtod(p, &end);
+    if( end == p ) {
+      cerr << filename << ':' << lineno << ": invalid number in \""
+	   << text << "\". Aborting\n";
+      exit(1);
+    }
+    args.push_back(v);
+    p = end;
+  }
+
+  // convert to a mask shape, finding which arguments are positions
+  // (pairs) and which are lengths
+  int mask_id;
+  int nopos = 1, nolen = 0;
+  if( name == "circle" ) {
+    mask_id = 1; nolen = 1;
+  } else if( name == "ellipse" ) {
+    mask_id = 2; nolen = 2;
+  } else if( name == "box" || name == "rotbox" ) {
+    mask_id = 3; nolen = 2;
+  } else if( name == "annulus" ) {
+    // keep only the innermost and outermost radii
+    if( args.size() > 4 )
+      args.erase(args.begin()+3, args.end()-1);
+    mask_id = 4; nolen = 2;
+  } else if( name == "polygon" ) {
+    mask_id = 5; nopos = args.size() / 2;
+  } else if( name == "rectangle" || name == "rotrectangle" ) {
+    // corners, which may not be whole pixels
+    if( args.size() != 4 && args.size() != 5 ) {
+      cerr << filename << ':' << lineno << ": rectangle needs 4 or 5 "
+	"arguments. Aborting\n";
+      exit(1);
+    }
+    const double xc = 0.5*(args[0]+args[2]), yc = 0.5*(args[1]+args[3]);
+    const double w = std::fabs(args[2]-args[0]);
+    const double h = std::fabs(args[3]-args[1]);
+    const double angle = args.size() == 5 ? args[4] : 0.;
+    args.clear();
+    args.push_back(xc); args.push_back(yc);
+    args.push_back(w); args.push_back(h); args.push_back(angle);
+    mask_id = 3; nolen = 2;
+  } else {
+    cerr << filename << ':' << lineno << ": unsupported shape \""
+	 << name << "\". Aborting\n";
+    exit(1);
+  }
+
+  if( int(args.size()) < nopos*2 + nolen ) {
+    cerr << filename << ':' << lineno << ": too few arguments for "
+	 << name << ". Aborting\n";
+    exit(1);
+  }
+
+  double_vec pos(args.begin(), args.begin()+nopos*2);
+  to_pixels(&pos);
+  std::copy(pos.begin(), pos.end(), args.begin());
+  for(int i=nopos*2; i<nopos*2+nolen; ++i)
+    args[i] *= m_physical ? m_ltm : 1.;
+
+  mask *mask_ptr = make_mask(mask_id, val);
+  mask_ptr -> interpret_args(args);
+  masks -> push_back(mask_ptr);
+}
+
+// region coordinates are 1-based
+void region_reader::to_pixels(double_vec *pos) const
+{
+  for(int i=0; i+1<int(pos->size()); i += 2) {
+    double &x = (*pos)[i], &y = (*pos)[i+1];
+    if( m_physical ) {
+      x = m_ltm*x + m_ltv1;
+      y = m_ltm*y + m_ltv2;
+    }
+    x -= 1.;
+    y -= 1.;
+  }
+}
+
+////////////////////////////////////////////////////////////////
+
 class mask_prog
 {
 public:
@@ -201,20 +807,37 @@ public:
 private:
   void interpret_mask(const string &mask_str);
   void get_input_image_size();
+  void read_regions();
   void draw_masks();
+  void draw_bands(int b1, int b2, unsigned thread);
   void write_total_mask();
 
 private:
   string m_output_file, m_input_file;
+  string m_region_file;
+  int m_threads;    // number of threads (0 for all cpus)
+  bool m_compress;  // tile-compress the output
   mask_vec m_masks;
+  int m_noregions;  // number of masks from the region file (first)
+
+  // the masks to draw in each band of rows, in order
+  vector< vector<int> > m_band_masks;
 
   int m_xw, m_yw;   // size of input image
-  CFITSImage m_mask_image;
+  double m_ltv1, m_ltv2, m_ltm;   // physical to image coordinates
+  vector<unsigned char> m_mask_image;   // 1 where masked
   CFITSPosn m_posn;
 };
 
+// rows in each band of the image which are drawn together
+const int c_band_rows = 64;
+
 mask_prog::mask_prog(int argc, char **argv)
-  : m_output_file("adbin_mask.fits")
+  : m_output_file("adbin_mask.fits"),
+    m_threads(0),
+    m_compress(false),
+    m_noregions(0),
+    m_ltv1(0.), m_ltv2(0.), m_ltm(1.)
 {
   parammm::param params(argc, argv);
   params.add_switch( parammm::pswitch("out", 'o',
@@ -224,11 +847,28 @@ mask_prog::mask_prog(int argc, char **argv)
   params.add_switch( parammm::pswitch("in", 'i',
 				      parammm::pstring_opt(&m_input_file),
 				      "set input file (required)", "FILE"));
+  params.add_switch( parammm::pswitch("regions", 'r',
+				      parammm::pstring_opt(&m_region_file),
+				      "read shapes from DS9/CIAO region file",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("compress", 'c',
+				      parammm::pbool_noopt(&m_compress),
+				      "tile-compress the output mask",
+				      ""));
 
   params.set_autohelp("Usage: MakeMask [OPTIONS] \"+/~mask(param,...)\" ...\n"
 		      "Creates a mask image.\n"
 		      "Options for mask are:\n"
-		      " rectangle(x1,y1,x2,y2) and circle(xc, yc, diameter)\n"
+		      " rectangle(x1,y1,x2,y2), circle(xc,yc,radius),\n"
+		      " ellipse(xc,yc,rx,ry[,angle]), "
+		      "box(xc,yc,width,height[,angle]),\n"
+		      " annulus(xc,yc,rin,rout) and "
+		      "polygon(x1,y1,x2,y2,x3,y3,...)\n"
+		      "Shapes from a region file are drawn before these.\n"
 		      "Written by Jeremy Sanders, 2001.",
 		      "Report bugs to <jss@ast.cam.ac.uk>");
   params.enable_autohelp();
@@ -239,9 +879,13 @@ mask_prog::mask_prog(int argc, char **argv)
 
   params.interpret_and_catch();
 
-  if( m_input_file.empty() || params.args().size() < 1 )
+  if( m_input_file.empty() ||
+      (params.args().size() < 1 && m_region_file.empty()) )
     params.show_autohelp();
 
+  if( m_threads <= 0 )
+    m_threads = AdaptiveBin::default_threads();
+
   for(int arg=0; arg<int(params.args().size()); ++arg)
     interpret_mask( params.args()[arg] );
 }
@@ -255,29 +899,78 @@ mask_prog::~mask_prog()
 
 void mask_prog::get_input_image_size()
 {
-  CFITSFile f(m_input_file.c_str(), CFITSFile::existingro);
-  m_xw = f.GetImage().GetXW();
-  m_yw = f.GetImage().GetYW();
+  CFITSFile f(m_input_file.c_str(), CFITSFile::existinghdr);
+  f.ReadImageSize(&m_xw, &m_yw);
   m_posn = f.GetPosn();
+
+  // for region files in physical coordinates
+  const CFloatType zero = 0., one = 1.;
+  f.ReadKey("LTV1", CFITSFile::tfloat, &m_ltv1, &zero);
+  f.ReadKey("LTV2", CFITSFile::tfloat, &m_ltv2, &zero);
+  f.ReadKey("LTM1_1", CFITSFile::tfloat, &m_ltm, &one);
 }
 
+void mask_prog::read_regions()
+{
+  mask_vec regions;
+  region_reader reader(m_ltv1, m_ltv2, m_ltm);
+  reader.read(m_region_file, &regions);
+
+  m_masks.insert(m_masks.begin(), regions.begin(), regions.end());
+  m_noregions = regions.size();
+
+  cout << "Read " << m_noregions << " shapes from " << m_region_file
+       << endl;
+}
+
+// the masks are sorted into bands of rows, keeping their order, and
+// the bands are drawn in parallel
 void mask_prog::draw_masks()
 {
-  for(int i=0; i<int(m_masks.size()); ++i)
-    m_masks[i]->draw(&m_mask_image);
+  const int nobands = (m_yw + c_band_rows - 1) / c_band_rows;
+  m_band_masks.assign(nobands, vector<int>());
+
+  for(int i=0; i<int(m_masks.size()); ++i) {
+    int y1, y2;
+    m_masks[i]->get_rows(&y1, &y2);
+    y1 = max(y1, 0);
+    y2 = min(y2, m_yw-1);
+
+    for(int b=y1/c_band_rows; y1<=y2 && b<=y2/c_band_rows; ++b)
+      m_band_masks[b].push_back(i);
+  }
+
+  AdaptiveBin::parallel_range(this, &mask_prog::draw_bands, nobands,
+			      m_threads);
+  m_band_masks.clear();
+}
+
+void mask_prog::draw_bands(int b1, int b2, unsigned thread)
+{
+  for(int b=b1; b<b2; ++b) {
+    const vector<int> &masks = m_band_masks[b];
+    for(int i=0; i<int(masks.size()); ++i)
+      m_masks[ masks[i] ]->draw(&m_mask_image[0], m_xw, m_yw,
+				b*c_band_rows, (b+1)*c_band_rows-1);
+  }
 }
 
 void mask_prog::write_total_mask()
 {
   CFITSFile f(m_output_file.c_str(), CFITSFile::create);
-  f.SetImage(m_mask_image);
+  if( m_compress )
+    f.SetTileCompression();
   f.SetPosn(m_posn);
-  f.WriteImage();
+  f.WriteByteImage(&m_mask_image[0], m_xw, m_yw);
   f.WriteHistory("Mask file generated by MakeMask for AdaptiveBin");
   const string s = "Mask generated for " + m_input_file;
   f.WriteHistory(s.c_str());
+  if( ! m_region_file.empty() ) {
+    const string s = "Shapes from region file " + m_region_file;
+    f.WriteHistory(s.c_str());
+  }
   f.WriteHistory("Parameters for mask listed below");
-  for(int i=0; i<int(m_masks.size()); ++i) {
+  for(int i=m_noregions; i<int(m_masks.size()); ++i) {
     const string s = "Mask: " + m_masks[i] -> get_description();
     f.WriteHistory(s.c_str());
   }
@@ -286,16 +979,17 @@ void mask_prog::write_total_mask()
 void mask_prog::run()
 {
   get_input_image_size();
-  m_mask_image.Resize(m_xw, m_yw);
-  m_mask_image.SetAll(0.);   // default, but do it again
+  if( ! m_region_file.empty() )
+    read_regions();
+  m_mask_image.assign(m_xw*m_yw, 0);
   draw_masks();
   write_total_mask();
 }
 
 void mask_prog::interpret_mask(const string &mask_str)
 {
-  const int no_names = 2;
-  const char *names[no_names] = {"rectangle", "circle"};
+  const int no_names = c_no_mask_names;
+  const char **names = c_mask_names;
 
   string mask_s = mask_str;       // copy mask_str
   double val = 1.;              // value to write in output
@@ -351,18 +1045,7 @@ void mask_prog::interpret_mask(const string &mask_str)
     }
   }
 
-  mask *mask_ptr = 0;
-  switch( mask_id ) {
-  case 0: // rectangle
-    mask_ptr = new rectangle_mask( val );
-    break;
-  case 1: // circle
-    mask_ptr = new circle_mask( val );
-    break;
-  default:
-    assert(false);
-  }
-
+  mask *mask_ptr = make_mask( mask_id, val );
   mask_ptr -> set_args(mask_parameters);
 
   cout << mask_ptr -> get_description() << endl;
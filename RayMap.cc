@@ -8,6 +8,8 @@
 #include <parammm/parammm.hh>
 #include <FITSFile.h>
 #include <FITSImage.h>
+#include "geommap.hh"
+#include "parallel.hh"
 #include "version.hh"
 
 using std::string;
@@ -17,17 +19,13 @@ class ray_prog
 public:
   ray_prog(int argc, char **argv);
 
-  void make_rays();
-
   void process();
 
 private:
   int m_xc, m_yc;        // x centre and y centre of rays
   int m_number_rays;     // number of rays
   double m_start_angle;  // angle for rays to start
-
-  CFITSImage m_outimage;
-  CFITSPosn m_posn;
+  int m_threads;         // number of threads (0 for all cpus)
 
   string m_binmap_fname;
   string m_input_fname;
@@ -38,6 +36,7 @@ ray_prog::ray_prog(int argc, char **argv)
   : m_xc(-1), m_yc(-1),
     m_number_rays(4),
     m_start_angle(0.),
+    m_threads(0),
 
     m_binmap_fname("ray_binmap.fits")
 {
@@ -64,6 +63,10 @@ ray_prog::ray_prog(int argc, char **argv)
 				      parammm::pdouble_opt(&m_start_angle),
 				      "Start angle",
 				      "DEG"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "VAL"));
 
   params.set_autohelp("Usage: RayMap [OPTIONS] file\n"
 		      "Produces a ray map on the same scale as input binmap\n"
@@ -81,54 +84,36 @@ ray_prog::ray_prog(int argc, char **argv)
     params.show_autohelp();
 
   m_input_fname = params.args()[0];
-}
-
-
-void ray_prog::make_rays()
-{
-  const int xw = m_outimage.GetXW(),
-    yw = m_outimage.GetYW();
-
-  const double rayangle = 360./m_number_rays;
-
-  for(int y=0; y<yw; ++y)
-    for(int x=0; x<xw; ++x) {
 
-      const int dx = x-m_xc, dy = y-m_yc;
-
-      // get angle between -180 -> 180
-      const double angle = atan2(dy, dx) * 180.0 / M_PI;
-
-      double da = angle-m_start_angle;
-      if(da < 0) da += 360.;
-
-      const int binno = int( da / rayangle );
-
-      m_outimage.SetPixel(x, y, binno);
-    }
+  if(m_number_rays < 1)
+    params.show_autohelp();
+  if(m_threads <= 0)
+    m_threads = AdaptiveBin::default_threads();
 }
 
+
 void ray_prog::process()
 {
+  int xw, yw;
+  CFITSPosn posn;
   {
-    CFITSFile f(m_input_fname.c_str(), CFITSFile::existingro);
-    CFITSImage temp = f.GetImage();
-    m_outimage.Resize(temp.GetXW(), temp.GetYW());
-    m_posn = f.GetPosn();
-
-    if(m_xc < 0 || m_yc < 0) {
-      m_xc = m_outimage.GetXW() / 2;
-      m_yc = m_outimage.GetYW() / 2;
-    }
+    CFITSFile f(m_input_fname.c_str(), CFITSFile::existinghdr);
+    f.ReadImageSize(&xw, &yw);
+    posn = f.GetPosn();
+  }
+
+  if(m_xc < 0 || m_yc < 0) {
+    m_xc = xw / 2;
+    m_yc = yw / 2;
   }
 
-  make_rays();
+  AdaptiveBin::geom_binmap binmap(xw, yw, 0, m_threads);
+  binmap.rays(m_xc, m_yc, m_number_rays, m_start_angle);
 
   {
     CFITSFile f(m_binmap_fname.c_str(), CFITSFile::create);
-    f.SetImage(m_outimage);
-    f.SetPosn(m_posn);
-    f.WriteImage();
+    f.SetPosn(posn);
+    f.WriteIntImage(&binmap.bins()[0], xw, yw);
   }
 }
 
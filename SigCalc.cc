@@ -1,10 +1,10 @@
 // SigCalc.cc
 
-#include <list>
+#include <vector>
 #include <cstdio>
 #include <cmath>
 #include <cassert>
-#include "../FITSImage.h"
+#include <FITSImage.h>
 #include "Coord.hh"
 #include "SigCalc.hh"
 
@@ -14,7 +14,9 @@ using namespace AdaptiveBin;
 using std::sqrt;
 using std::fabs;
 
-CSigCalc::CSigCalc()
+CSigCalc::CSigCalc(int xw, int yw)
+  : m_xw(xw), m_yw(yw),
+    m_mask(xw*yw, false)
 {
 }
 
@@ -22,341 +24,204 @@ CSigCalc::~CSigCalc()
 {
 }
 
-/// Count significance ///////////
-
-CCountSig::CCountSig(const CFITSImage &image) :
-  m_image(image),
-  m_maskImage(GetXW(), GetYW())
+int CSigCalc::getTotals(const cSpanList &spans, std::vector<double> *totals)
 {
-}
+  totals->assign(GetNoBands(), 0.);
 
-int CCountSig::GetNoValues()
-{
-  return 1;
+  int count = 0;
+  for(cSpanList::const_iterator s = spans.begin(); s != spans.end(); ++s) {
+    AddSpanBands(*s, &(*totals)[0]);
+    count += s->m_x2 - s->m_x1;
+  }
+  return count;
 }
 
-int CCountSig::GetXW()
+double CSigCalc::GetValue(const cSpanList &spans, int value)
 {
-  return m_image.GetXW();
-}
+  assert( ! spans.empty() );
 
-int CCountSig::GetYW()
-{
-  return m_image.GetYW();
+  std::vector<double> totals;
+  const int count = getTotals(spans, &totals);
+  return GetTotalsValue(&totals[0], count, value);
 }
 
-double CCountSig::GetValue(const cCoordList &points,
-			   int value)
+double CSigCalc::GetError(const cSpanList &spans, int value)
 {
-  assert( value == 0 );
-  assert( ! points.empty() );
+  assert( ! spans.empty() );
 
-  cCoordList::const_iterator p = points.begin();
-
-  double tot = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tot += m_image.GetPixel( p->m_x, p->m_y );
-    ++count;
-    ++p;
-  }
-
-  return tot/count;
+  std::vector<double> totals;
+  const int count = getTotals(spans, &totals);
+  return GetTotalsError(&totals[0], count, value);
 }
 
-double CCountSig::GetError(const cCoordList &points,
-			   int value)
+void CSigCalc::Evaluate(const cSpanList &spans, double *values,
+			double *errors)
 {
-  assert( ! points.empty() );
-  assert( value == 0 );
+  assert( ! spans.empty() );
 
-  cCoordList::const_iterator p = points.begin();
+  std::vector<double> totals;
+  const int count = getTotals(spans, &totals);
 
-  double tot = 0.0;
-  while( p != points.end() ) {
-    tot += m_image.GetPixel( p->m_x, p->m_y );
-    ++p;
+  const int novalues = GetNoValues();
+  for(int v = 0; v < novalues; v++) {
+    values[v] = GetTotalsValue(&totals[0], count, v);
+    errors[v] = GetTotalsError(&totals[0], count, v);
   }
-  if( fabs(tot) < 1e-5 ) return 1e5;
-
-  return 1.0/sqrt(tot);
 }
 
-void CCountSig::Mask( CCoord p )
+void CSigCalc::Mask( const cSpanList &spans )
 {
-  m_maskImage.SetPixel(p.m_x, p.m_y, 1.0);
+  for(cSpanList::const_iterator s = spans.begin(); s != spans.end(); ++s)
+    for(int x = s->m_x1; x < s->m_x2; x++)
+      m_mask[x + s->m_y*m_xw] = true;
 }
 
-bool CCountSig::IsMasked( CCoord p )
+void CSigCalc::AddUnmaskedSpans(int x1, int y1, int x2, int y2,
+				cSpanList *spans) const
 {
-  return( fabs(m_maskImage.GetPixel(p.m_x, p.m_y)) > 1e-5 );
+  for(int y = y1; y < y2; y++) {
+    const int row = y*m_xw;
+    int x = x1;
+    for(;;) {
+      while( x < x2 && m_mask[row+x] )
+	x++;
+      if( x >= x2 )
+	break;
+      const int start = x;
+      while( x < x2 && ! m_mask[row+x] )
+	x++;
+      spans->push_back( CSpan(y, start, x) );
+    }
+  }
 }
 
-// Ratio significance //////////////////////////////
+/// Count significance ///////////
 
-CRatioSig::CRatioSig(const CFITSImage &imagea,
-		     const CFITSImage &imageb  ) :
-  m_imagea(imagea),
-  m_imageb(imageb),
-  m_maskImage(GetXW(), GetYW())
+CCountSig::CCountSig(const CFITSImage &image) :
+  CSigCalc(image.GetXW(), image.GetYW()),
+  m_image(image)
 {
 }
 
-int CRatioSig::GetNoValues()
+int CCountSig::GetNoValues()
 {
-  return 3;  // ratio, count1, count2
+  return 1;
 }
 
-int CRatioSig::GetXW()
+int CCountSig::GetNoBands()
 {
-  return m_imagea.GetXW();
+  return 1;
 }
 
-int CRatioSig::GetYW()
+void CCountSig::AddSpanBands( const CSpan &span, double *bands )
 {
-  return m_imagea.GetYW();
+  const CFloatType *p = m_image.GetConstImageBuffer() +
+    span.m_y*GetXW();
+  for(int x = span.m_x1; x < span.m_x2; x++)
+    bands[0] += p[x];
 }
 
-double CRatioSig::GetValue(const cCoordList &points,
-			   int value)
+double CCountSig::GetTotalsValue(const double *totals, int count,
+				 int value)
 {
-  assert( ! points.empty() );
-  assert( value < 3 );
-
-  cCoordList::const_iterator p = points.begin();
-
-  double tota = 0.0;
-  double totb = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tota += m_imagea.GetPixel( p->m_x, p->m_y );
-    totb += m_imageb.GetPixel( p->m_x, p->m_y );
-    ++p; ++count;
-  }
-
-  if( fabs(totb) < 1e-5) return 1e5;
-
-  switch(value) {
-  case 1: return tota/count;
-  case 2: return totb/count;
-  default: return tota/totb;
-  }
+  assert( value == 0 );
+  return totals[0]/count;
 }
 
-double CRatioSig::GetError(const cCoordList &points,
-			   int value)
+double CCountSig::GetTotalsError(const double *totals, int count,
+				 int value)
 {
-  assert( ! points.empty() );
+  assert( value == 0 );
+  if( fabs(totals[0]) < 1e-5 ) return 1e5;
 
-  cCoordList::const_iterator p = points.begin();
+  return 1.0/sqrt(totals[0]);
+}
 
-  double tota = 0.0;
-  double totb = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tota += m_imagea.GetPixel( p->m_x, p->m_y );
-    totb += m_imageb.GetPixel( p->m_x, p->m_y );
-    ++count;
-    ++p;
-  }
+// Ratio significance for any number of bands //////////////
 
-  if( fabs(totb) < 1e-5 || fabs(tota) < 1e-5 )
-    return 1e5;
+CBandSig::CBandSig(const std::vector<CFITSImage> &images)
+  : CSigCalc(images[0].GetXW(), images[0].GetYW()),
+    m_nobands(images.size()),
+    m_bands(images.size() * images[0].GetNoPixels())
+{
+  assert( m_nobands >= 2 );
 
-  switch(value) {
-  case 1: return 1.0/sqrt(tota);
-  case 2: return 1.0/sqrt(totb);
-  default: return sqrt( 1.0/tota + 1.0/totb );
-  }
-}
+  // the ratios of neighbouring bands only differ from the first
+  // ratio with three or more bands
+  m_noratios = (m_nobands >= 3) ? m_nobands : 0;
 
-void CRatioSig::Mask( CCoord p )
-{
-  m_maskImage.SetPixel(p.m_x, p.m_y, 1.0);
-}
+  // interleave the bands
+  const int nopixels = images[0].GetNoPixels();
+  for(int b = 0; b < m_nobands; b++) {
+    assert( images[b].GetXW() == GetXW() && images[b].GetYW() == GetYW() );
 
-bool CRatioSig::IsMasked( CCoord p )
-{
-  return( fabs(m_maskImage.GetPixel(p.m_x, p.m_y)) > 1e-5 );
+    const CFloatType *in = images[b].GetConstImageBuffer();
+    for(int i = 0; i < nopixels; i++)
+      m_bands[i*m_nobands + b] = in[i];
+  }
 }
 
-//// Ratio file which also takes account of third colour
-
-CRatioSig3::CRatioSig3(const CFITSImage &imagea,
-		       const CFITSImage &imageb,
-		       const CFITSImage &imagec)
-  : CRatioSig(imagea, imageb),
-    m_imagec(imagec)
+int CBandSig::GetNoValues()
 {
+  return 1 + m_noratios + m_nobands;
 }
 
-int CRatioSig3::GetNoValues()
+int CBandSig::GetNoBands()
 {
-  return 7;
+  return m_nobands;
 }
 
-double CRatioSig3::GetValue(const cCoordList &points,
-			    int value)
+void CBandSig::AddSpanBands( const CSpan &span, double *bands )
 {
-  assert( value < 7 );
-  assert( ! points.empty() );
+  const int nb = m_nobands;
+  const double *p = &m_bands[ (span.m_x1 + span.m_y*GetXW()) * nb ];
+  const double *end = p + (span.m_x2 - span.m_x1) * nb;
 
-  cCoordList::const_iterator p = points.begin();
-
-  double tota = 0.0;
-  double totb = 0.0;
-  double totc = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tota += m_imagea.GetPixel( p->m_x, p->m_y );
-    totb += m_imageb.GetPixel( p->m_x, p->m_y );
-    totc += m_imagec.GetPixel( p->m_x, p->m_y );
-    ++count;
-    ++p;
-  }
-
-  switch(value) {
-  case 1: return tota/totb;
-  case 2: return totb/totc;
-  case 3: return totc/tota;
-  case 4: return tota/count;
-  case 5: return totb/count;
-  case 6: return totc/count;
-  default: return tota/totb;
-  }
+  for( ; p != end; p += nb )
+    for(int b = 0; b < nb; b++)
+      bands[b] += p[b];
 }
 
-double CRatioSig3::GetError(const cCoordList &points,
-			    int value)
+double CBandSig::GetTotalsValue(const double *totals, int count,
+				int value)
 {
-  assert( value < 7 );
-  assert( ! points.empty() );
-
-  cCoordList::const_iterator p = points.begin();
-
-  double tota = 0.0;
-  double totb = 0.0;
-  double totc = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tota += m_imagea.GetPixel( p->m_x, p->m_y );
-    totb += m_imageb.GetPixel( p->m_x, p->m_y );
-    totc += m_imagec.GetPixel( p->m_x, p->m_y );
-    ++count;
-    ++p;
-  }
+  assert( value < GetNoValues() );
 
-  if( fabs(totb) < 1e-5 || fabs(tota) < 1e-5 ||
-      fabs(totc) < 1e-5 )
+  // with two bands, an empty second band gives 1e5 for every value
+  // (including the counts), as the two band calculator always has
+  if( m_nobands == 2 && fabs(totals[1]) < 1e-5 )
     return 1e5;
 
-  double errab = sqrt(1.0/tota + 1.0/totb);
-  double errbc = sqrt(1.0/totb + 1.0/totc);
-  double errca = sqrt(1.0/totc + 1.0/tota);
-
-  switch(value) {
-  case 1: return errab;
-  case 2: return errbc;
-  case 3: return errca;
-  case 4: return 1.0/sqrt(tota);
-  case 5: return 1.0/sqrt(totb);
-  case 6: return 1.0/sqrt(totc);
-    //  default: return (errab+errbc+errca)/3.0;
-  default: return sqrt(1.0/tota+1.0/totb+1.0/totc);
-  }
-}
+  if( value > m_noratios )
+    return totals[value-m_noratios-1] / count;
 
-//// Ratio file which also takes account of fourth(!) colour
+  // ratio of band i to the next (value 0 is the first ratio)
+  const int i = (value == 0) ? 0 : value-1;
+  const double denom = totals[ (i+1) % m_nobands ];
+  if( fabs(denom) < 1e-5 ) return 1e5;
 
-CRatioSig4::CRatioSig4(const CFITSImage &imagea,
-		       const CFITSImage &imageb,
-		       const CFITSImage &imagec,
-		       const CFITSImage &imaged)
-  : CRatioSig(imagea, imageb),
-    m_imagec(imagec), m_imaged(imaged)
-{
+  return totals[i] / denom;
 }
 
-int CRatioSig4::GetNoValues()
+double CBandSig::GetTotalsError(const double *totals, int count,
+				int value)
 {
-  return 9;
-}
-
-double CRatioSig4::GetValue(const cCoordList &points,
-			    int value)
-{
-  assert( value < 9 );
-  assert( ! points.empty() );
-
-  cCoordList::const_iterator p = points.begin();
-
-  double tota = 0.0;
-  double totb = 0.0;
-  double totc = 0.0;
-  double totd = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tota += m_imagea.GetPixel( p->m_x, p->m_y );
-    totb += m_imageb.GetPixel( p->m_x, p->m_y );
-    totc += m_imagec.GetPixel( p->m_x, p->m_y );
-    totd += m_imaged.GetPixel( p->m_x, p->m_y );
-    ++count;
-    ++p;
-  }
+  assert( value < GetNoValues() );
 
-  switch(value) {
-  case 1: return tota/totb;
-  case 2: return totb/totc;
-  case 3: return totc/totd;
-  case 4: return totd/tota;
-  case 5: return tota/count;
-  case 6: return totb/count;
-  case 7: return totc/count;
-  case 8: return totd/count;
-  default: return tota/totb;
-  }
-}
-
-double CRatioSig4::GetError(const cCoordList &points,
-			    int value)
-{
-  assert( value < 9 );
-  assert( ! points.empty() );
+  for(int b = 0; b < m_nobands; b++)
+    if( fabs(totals[b]) < 1e-5 )
+      return 1e5;
 
-  cCoordList::const_iterator p = points.begin();
+  if( value > m_noratios )
+    return 1.0/sqrt( totals[value-m_noratios-1] );
 
-  double tota = 0.0;
-  double totb = 0.0;
-  double totc = 0.0;
-  double totd = 0.0;
-  int count = 0;
-  while( p != points.end() ) {
-    tota += m_imagea.GetPixel( p->m_x, p->m_y );
-    totb += m_imageb.GetPixel( p->m_x, p->m_y );
-    totc += m_imagec.GetPixel( p->m_x, p->m_y );
-    totd += m_imaged.GetPixel( p->m_x, p->m_y );
-    ++count;
-    ++p;
+  if( value == 0 ) {
+    double sum = 0.;
+    for(int b = 0; b < m_nobands; b++)
+      sum += 1.0/totals[b];
+    return sqrt(sum);
   }
 
-  if( fabs(totb) < 1e-5 || fabs(tota) < 1e-5 ||
-      fabs(totc) < 1e-5 || fabs(totd) < 1e-5 )
-    return 1e5;
-
-  double errab = sqrt(1.0/tota + 1.0/totb);
-  double errbc = sqrt(1.0/totb + 1.0/totc);
-  double errcd = sqrt(1.0/totc + 1.0/totd);
-  double errda = sqrt(1.0/totd + 1.0/tota);
-
-  switch(value) {
-  case 1: return errab;
-  case 2: return errbc;
-  case 3: return errcd;
-  case 4: return errda;
-  case 5: return 1.0/sqrt(tota);
-  case 6: return 1.0/sqrt(totb);
-  case 7: return 1.0/sqrt(totc);
-  case 8: return 1.0/sqrt(totd);
-  default: return sqrt(1.0/tota+1.0/totb+1.0/totc+1.0/totd);
-  }
+  const int i = value-1;
+  return sqrt( 1.0/totals[i] + 1.0/totals[(i+1) % m_nobands] );
 }
@@ -1,30 +1,69 @@
 #ifndef ADAPTIVEBLOCK_SIGCALC_HH
 #define ADAPTIVEBLOCK_SIGCALC_HH
 
+#include <vector>
+
 namespace AdaptiveBin {
 
+  // points in row m_y with m_x1 <= x < m_x2
+  class CSpan {
+  public:
+    CSpan(int y, int x1, int x2) : m_y(y), m_x1(x1), m_x2(x2) {}
+
+    int m_y, m_x1, m_x2;
+  };
+
   // value specifies the possible number of results
 
   class CSigCalc {
   public:
-    CSigCalc();
+    CSigCalc(int xw, int yw);
     virtual ~CSigCalc();
 
-    typedef list<CCoord> cCoordList;
-    typedef list<CCoordV> cCoordVList;
+    typedef std::vector<CSpan> cSpanList;
 
     virtual int GetNoValues() = 0;
     // get no possible values
 
-    virtual int GetXW() = 0;
-    virtual int GetYW() = 0;
-    virtual double GetValue(const cCoordList &points,
-			    int value = 0) = 0;
-    virtual double GetError(const cCoordList &points,
-			    int value = 0) = 0;
+    int GetXW() const { return m_xw; }
+    int GetYW() const { return m_yw; }
+
+    double GetValue(const cSpanList &spans, int value = 0);
+    double GetError(const cSpanList &spans, int value = 0);
+    void Evaluate(const cSpanList &spans, double *values,
+		  double *errors);
+    // get all GetNoValues() values and errors, totalling the
+    // points once
+
+    // masked points are ones which have been binned
+    void Mask( CCoord p ) { m_mask[p.m_x + p.m_y*m_xw] = true; }
+    bool IsMasked( CCoord p ) const { return m_mask[p.m_x + p.m_y*m_xw]; }
+    void Mask( const cSpanList &spans );
+    void AddUnmaskedSpans(int x1, int y1, int x2, int y2,
+			  cSpanList *spans) const;
+    // add spans of unmasked points with x1<=x<x2, y1<=y<y2
+
+    // the value and error only depend on the total of each band
+    // (input image) over the points, so they can be found from
+    // running totals
+    virtual int GetNoBands() = 0;
+    virtual void AddSpanBands( const CSpan &span, double *bands ) = 0;
+    // add up the bands of the points in the span
+    void GetPixelBands( CCoord p, double *bands )
+    { AddSpanBands( CSpan(p.m_y, p.m_x, p.m_x+1), bands ); }
+
+    virtual double GetTotalsValue(const double *totals, int count,
+				  int value = 0) = 0;
+    virtual double GetTotalsError(const double *totals, int count,
+				  int value = 0) = 0;
+    // get value and error for band totals of count points
 
-    virtual void Mask( CCoord p ) = 0;
-    virtual bool IsMasked( CCoord p ) = 0;
+  private:
+    int getTotals(const cSpanList &spans, std::vector<double> *totals);
+
+  private:
+    const int m_xw, m_yw;
+    std::vector<bool> m_mask;
   };
 
 
@@ -35,81 +74,39 @@ namespace AdaptiveBin {
     virtual int GetNoValues();
     // 0 - count
 
-    virtual int GetXW();
-    virtual int GetYW();
-    virtual double GetValue(const cCoordList &points,
-			    int value = 0);
-    virtual double GetError(const cCoordList &points,
-			    int value = 0);
-    virtual void Mask( CCoord p );
-    virtual bool IsMasked( CCoord p );
+    virtual int GetNoBands();
+    virtual void AddSpanBands( const CSpan &span, double *bands );
+    virtual double GetTotalsValue(const double *totals, int count,
+				  int value = 0);
+    virtual double GetTotalsError(const double *totals, int count,
+				  int value = 0);
 
   private:
     const CFITSImage m_image;
-    CFITSImage m_maskImage;
   };
 
-  class CRatioSig : public CSigCalc {
+  // ratios and counts of any number of bands (two or more)
+  // the bands of each pixel are stored together
+  class CBandSig : public CSigCalc {
   public:
-    CRatioSig(const CFITSImage &imagea,
-	      const CFITSImage &imageb);
+    CBandSig(const std::vector<CFITSImage> &images);
 
     virtual int GetNoValues();
-    // 0 - ratio, 1 = counta, 2 = countb
-
-    virtual int GetXW();
-    virtual int GetYW();
-    virtual double GetValue(const cCoordList &points,
-			    int value = 0);
-    virtual double GetError(const cCoordList &points,
-			    int value = 0);
-    virtual void Mask( CCoord p );
-    virtual bool IsMasked( CCoord p );
+    // 0 - ratio a/b (using error of all bands)
+    // with 3 or more bands, 1..n - ratio a/b, b/c, ... (last)/a
+    // then counts of each band
 
-  protected:
-    const CFITSImage m_imagea, m_imageb;
+    virtual int GetNoBands();
+    virtual void AddSpanBands( const CSpan &span, double *bands );
+    virtual double GetTotalsValue(const double *totals, int count,
+				  int value = 0);
+    virtual double GetTotalsError(const double *totals, int count,
+				  int value = 0);
 
   private:
-    CFITSImage m_maskImage;
-  };
-
-  class CRatioSig3 : public CRatioSig {
-  public:
-    CRatioSig3(const CFITSImage &imagea,
-	       const CFITSImage &imageb,
-	       const CFITSImage &imagec);
-
-    virtual int GetNoValues();
-    // 0 - ratio a/b (using error of a/b/c)
-    // 1 - ratio a/b, 2 - ratio b/c, 3 - ratio c/a
-    // 4 - count a, 5 - countb, 6 - countc
-
-    virtual double GetValue(const cCoordList &points,
-			    int value = 0);
-    virtual double GetError(const cCoordList &points,
-			    int value = 0);
-  private:
-    const CFITSImage m_imagec;
-  };
-
-  class CRatioSig4 : public CRatioSig {
-  public:
-    CRatioSig4(const CFITSImage &imagea,
-	       const CFITSImage &imageb,
-	       const CFITSImage &imagec,
-	       const CFITSImage &imaged);
-
-    virtual int GetNoValues();
-    // 0 - ratio a/b (using average error of a/b/c/d)
-    // 1 - ratio a/b, 2 - ratio b/c, 3 - ratio c/d, 4 - ratio d/a
-    // 5 - count a, 6 - countb, 7 - countc, 8 - countd
-
-    virtual double GetValue(const cCoordList &points,
-			    int value = 0);
-    virtual double GetError(const cCoordList &points,
-			    int value = 0);
-  private:
-    const CFITSImage m_imagec, m_imaged;
+    const int m_nobands;
+    int m_noratios;                 // number of ratios after the first
+    std::vector<double> m_bands;    // band values for each pixel
   };
 
 }
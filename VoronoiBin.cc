@@ -0,0 +1,727 @@
+//      Adaptive Binning Program
+//      Weighted Voronoi tessellation binning
+//      Routines for adaptively binning data
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Bins are first made by accretion (as in Cappellari & Copin 2003):
+// starting from the unbinned pixel with the best signal to noise,
+// the nearest neighbouring pixels are added until the fractional
+// error threshold is reached. The centroids of these bins are then
+// used as generators of a weighted Voronoi tessellation
+// (Diehl & Statler 2006), which is iterated, moving the generators
+// to the centroids of their bins and rescaling their weights by
+// how far each bin is from the threshold.
+
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <utility>
+#include <sstream>
+#include <cassert>
+#include <cmath>
+
+#include <parammm/parammm.hh>
+#include <FITSFile.h>
+
+#include "binmodule.hh"
+#include "maskimage.hh"
+#include "parallel.hh"
+#include "version.hh"
+
+using std::string;
+using std::sort;
+using std::vector;
+using std::pair;
+using std::make_pair;
+using std::cout;
+using std::cerr;
+using std::clog;
+using std::endl;
+using std::ostringstream;
+using std::sqrt;
+
+namespace AdaptiveBin {
+
+  const int c_masked = -1;
+  const int c_unbinned = -2;
+  const int c_accreted = -3;
+
+  // stop iterating when no generator moves further than this (pixels)
+  const double c_converged = 0.01;
+
+  // a bin generator: its position and scale length
+  class generator
+  {
+  public:
+    generator(double x, double y, double scale)
+      : m_x(x), m_y(y), m_scale(scale) {}
+
+    double m_x, m_y;
+    double m_scale;
+  };
+
+  typedef vector<generator> generator_list;
+
+  // the pixels assigned to a generator
+  class generator_stats
+  {
+  public:
+    generator_stats(const binsums &sums)
+      : m_sums(sums), m_sumx(0.), m_sumy(0.) {}
+
+    binsums m_sums;
+    double m_sumx, m_sumy;
+  };
+
+  typedef vector<generator_stats> generator_stats_list;
+
+  // voronoi_binner makes the tessellation
+  // it uses the binmodule to find the errors on each bin
+
+  class voronoi_binner
+  {
+  public:
+    voronoi_binner(binmodule *bm, double threshold,
+		   int maxiters, unsigned nothreads);
+    // bm is binning module (by which mode we're binning)
+    // threshold is fractional error threshold
+    // maxiters is maximum number of tessellation iterations
+
+    ~voronoi_binner();
+
+    void bin(CFITSImage *out_image,
+	     CFITSImage *error_image,
+	     CFITSImage *binmap_image);
+
+    void set_mask(const vector<bool> &masked);
+    // pixels set in masked (one per pixel, row by row) are not binned
+
+  private:
+    void accrete_bins();
+    void build_grid();
+    int nearest_generator(int x, int y) const;
+    void assign_rows(int y1, int y2, unsigned thread);
+    void assign_pixels();
+    double move_generators();
+    void paint_output();
+
+  private:
+    binmodule *m_binmod;                     // module to do the binning
+    double m_threshold;                      // threshold error value
+    int m_maxiters;                          // max number of iterations
+    unsigned m_nothreads;                    // threads to assign pixels
+    const int m_xw, m_yw;
+
+    vector<int> m_assign;                    // generator for each pixel
+    generator_list m_gens;                   // the bin generators
+
+    // grid of cells holding the generators inside each cell,
+    // so the nearest generator of a pixel can be found quickly
+    int m_cellsize, m_gridxw, m_gridyw;
+    vector< vector<int> > m_cells;
+    double m_maxscale;
+
+    generator_stats_list m_stats;                 // totals of each bin
+    vector<generator_stats_list> m_thread_stats;  // ... for each thread
+
+    CFITSImage m_out_image;                  // output binned image
+    CFITSImage m_error_image;                // output error image
+    CFITSImage m_output_binmap_image;        // output binmap
+  };
+
+  voronoi_binner::voronoi_binner(binmodule *bm, double threshold,
+				 int maxiters, unsigned nothreads)
+    : m_binmod(bm),
+      m_threshold(threshold),
+      m_maxiters(maxiters),
+      m_nothreads(nothreads),
+      m_xw(bm->xw()), m_yw(bm->yw()),
+      m_assign(m_xw*m_yw, c_unbinned),
+      m_cellsize(1), m_gridxw(0), m_gridyw(0),
+      m_maxscale(1.),
+      m_out_image(m_xw, m_yw),
+      m_error_image(m_xw, m_yw),
+      m_output_binmap_image(m_xw, m_yw)
+  {
+  }
+
+  voronoi_binner::~voronoi_binner()
+  {
+  }
+
+  void voronoi_binner::set_mask(const vector<bool> &masked)
+  {
+    // check mask is the same size as the image
+    assert( int(masked.size()) == m_xw*m_yw );
+
+    for(int i=0; i<m_xw*m_yw; ++i)
+      if( masked[i] )
+	m_assign[i] = c_masked;
+  }
+
+  void voronoi_binner::bin(CFITSImage *out_image,
+			   CFITSImage *error_image,
+			   CFITSImage *binmap_image)
+  {
+    accrete_bins();
+    cout << "Accreted " << m_gens.size() << " bins" << endl;
+
+    for(int iter=1; iter<=m_maxiters; ++iter)
+      {
+	assign_pixels();
+	const double move = move_generators();
+
+	cout << "Iteration " << iter << ": " << m_gens.size()
+	     << " bins, maximum movement " << move << endl;
+	if( move < c_converged )
+	  break;
+      }
+
+    assign_pixels();
+    paint_output();
+
+    // return values
+    *out_image = m_out_image;
+    *error_image = m_error_image;
+    *binmap_image = m_output_binmap_image;
+  }
+
+  void voronoi_binner::accrete_bins()
+  {
+    const int nopix = m_xw*m_yw;
+
+    // order unmasked pixels by their own signal to noise, best first
+    vector< pair<double, int> > order;
+    for(int i=0; i<nopix; ++i)
+      if( m_assign[i] != c_masked )
+	{
+	  binsums sums = m_binmod->newsums();
+	  m_binmod->addpixel(&sums, i % m_xw, i / m_xw);
+	  const double error = m_binmod->fracerror(sums, true);
+	  const double sn = error > 0. ? 1./error : 0.;
+	  order.push_back( make_pair(-sn, i) );
+	}
+    sort(order.begin(), order.end());
+
+    // pixels on the edge of the bin being grown, nearest the seed first
+    typedef pair<double, int> frontier_pixel;
+    std::priority_queue< frontier_pixel, vector<frontier_pixel>,
+			 std::greater<frontier_pixel> > frontier;
+    vector<int> queued(nopix, -1);
+
+    double sumx = 0., sumy = 0.;
+    int totpix = 0;
+
+    for(int attempt=0; attempt<int(order.size()); ++attempt)
+      {
+	const int seed = order[attempt].second;
+	if( m_assign[seed] != c_unbinned )
+	  continue;
+
+	const int sx = seed % m_xw, sy = seed / m_xw;
+	binsums sums = m_binmod->newsums();
+	double binx = 0., biny = 0.;
+	double error = -1.;
+
+	frontier.push( make_pair(0., seed) );
+	queued[seed] = attempt;
+
+	// add the nearest pixel to the seed until the bin is good enough
+	// (bins dominated by background have a -ve error, so aren't)
+	while( ! frontier.empty() )
+	  {
+	    const int p = frontier.top().second;
+	    frontier.pop();
+
+	    const int px = p % m_xw, py = p / m_xw;
+	    m_binmod->addpixel(&sums, px, py);
+	    m_assign[p] = c_accreted;
+	    binx += px; biny += py;
+
+	    error = m_binmod->fracerror(sums, true);
+	    if( error > 0. && error <= m_threshold )
+	      break;
+
+	    for(int dy=-1; dy<=1; ++dy)
+	      for(int dx=-1; dx<=1; ++dx)
+		{
+		  const int nx = px+dx, ny = py+dy;
+		  if( nx < 0 || ny < 0 || nx >= m_xw || ny >= m_yw )
+		    continue;
+		  const int n = nx+ny*m_xw;
+		  if( m_assign[n] != c_unbinned || queued[n] == attempt )
+		    continue;
+
+		  queued[n] = attempt;
+		  const double ddx = nx-sx, ddy = ny-sy;
+		  frontier.push( make_pair(ddx*ddx+ddy*ddy, n) );
+		}
+	  }
+
+	// leave the rest of the frontier unbinned
+	while( ! frontier.empty() )
+	  frontier.pop();
+
+	sumx += binx; sumy += biny;
+	totpix += sums.m_npix;
+
+	// failed bins are left to be picked up by their neighbours
+	if( error > 0. && error <= m_threshold )
+	  {
+	    const double n = sums.m_npix;
+	    m_gens.push_back( generator(binx/n, biny/n,
+					sqrt(n)*error/m_threshold) );
+	  }
+      }
+
+    // nothing reached the threshold, so make one bin of everything
+    if( m_gens.empty() && totpix > 0 )
+      m_gens.push_back( generator(sumx/totpix, sumy/totpix, 1.) );
+  }
+
+  void voronoi_binner::build_grid()
+  {
+    int nounmasked = 0;
+    for(int i=0; i<m_xw*m_yw; ++i)
+      if( m_assign[i] != c_masked )
+	++nounmasked;
+
+    // make cells about the size of an average bin
+    const int nogens = std::max(int(m_gens.size()), 1);
+    m_cellsize = std::max( int(sqrt(double(nounmasked)/nogens)), 1 );
+    m_gridxw = m_xw / m_cellsize + 1;
+    m_gridyw = m_yw / m_cellsize + 1;
+
+    m_cells.assign(m_gridxw*m_gridyw, vector<int>());
+    m_maxscale = 0.;
+    for(int g=0; g<int(m_gens.size()); ++g)
+      {
+	const generator &gen = m_gens[g];
+	int cx = int(gen.m_x) / m_cellsize;
+	int cy = int(gen.m_y) / m_cellsize;
+	cx = std::min( std::max(cx, 0), m_gridxw-1 );
+	cy = std::min( std::max(cy, 0), m_gridyw-1 );
+
+	m_cells[cx+cy*m_gridxw].push_back(g);
+	m_maxscale = std::max(m_maxscale, gen.m_scale);
+      }
+  }
+
+  int voronoi_binner::nearest_generator(int x, int y) const
+  {
+    // search square rings of cells outwards from the pixel's cell,
+    // stopping when no generator further out can have a smaller
+    // weighted distance (distance / scale) than the best so far
+
+    const int cx = x / m_cellsize, cy = y / m_cellsize;
+    const int maxring = std::max(m_gridxw, m_gridyw);
+
+    double best = 1e300;      // best weighted distance squared
+    int bestgen = -1;
+
+    for(int ring=0; ring<=maxring; ++ring)
+      {
+	if( bestgen >= 0 && ring > 1 )
+	  {
+	    const double mindist = (ring-1)*m_cellsize/m_maxscale;
+	    if( mindist*mindist >= best )
+	      break;
+	  }
+
+	for(int gy=cy-ring; gy<=cy+ring; ++gy)
+	  {
+	    if( gy < 0 || gy >= m_gridyw )
+	      continue;
+
+	    // only the edge of the ring
+	    const bool edge = (gy == cy-ring || gy == cy+ring);
+	    const int step = edge ? 1 : 2*ring;
+
+	    for(int gx=cx-ring; gx<=cx+ring; gx += step)
+	      {
+		if( gx < 0 || gx >= m_gridxw )
+		  continue;
+
+		const vector<int> &cell = m_cells[gx+gy*m_gridxw];
+		for(int i=0; i<int(cell.size()); ++i)
+		  {
+		    const generator &gen = m_gens[cell[i]];
+		    const double dx = x-gen.m_x, dy = y-gen.m_y;
+		    const double d = (dx*dx+dy*dy) /
+		      (gen.m_scale*gen.m_scale);
+		    if( d < best )
+		      {
+			best = d;
+			bestgen = cell[i];
+		      }
+		  }
+	      }
+	  }
+      }
+
+    return bestgen;
+  }
+
+  void voronoi_binner::assign_rows(int y1, int y2, unsigned thread)
+  {
+    generator_stats_list &stats = m_thread_stats[thread];
+
+    for(int y=y1; y<y2; ++y)
+      for(int x=0; x<m_xw; ++x)
+	{
+	  const int i = x+y*m_xw;
+	  if( m_assign[i] == c_masked )
+	    continue;
+
+	  const int g = nearest_generator(x, y);
+	  m_assign[i] = g;
+
+	  m_binmod->addpixel(&stats[g].m_sums, x, y);
+	  stats[g].m_sumx += x;
+	  stats[g].m_sumy += y;
+	}
+  }
+
+  void voronoi_binner::assign_pixels()
+  {
+    build_grid();
+
+    const generator_stats empty( m_binmod->newsums() );
+    m_stats.assign(m_gens.size(), empty);
+    m_thread_stats.assign(m_nothreads,
+			  generator_stats_list(m_gens.size(), empty));
+
+    parallel_range(this, &voronoi_binner::assign_rows, m_yw, m_nothreads);
+
+    // combine totals from each thread
+    for(unsigned t=0; t<m_thread_stats.size(); ++t)
+      for(int g=0; g<int(m_gens.size()); ++g)
+	{
+	  const generator_stats &ts = m_thread_stats[t][g];
+	  m_stats[g].m_sums.add(ts.m_sums);
+	  m_stats[g].m_sumx += ts.m_sumx;
+	  m_stats[g].m_sumy += ts.m_sumy;
+	}
+  }
+
+  double voronoi_binner::move_generators()
+  {
+    // move generators to the centroids of their bins, and make
+    // bins with a larger error than the threshold grow
+
+    generator_list newgens;
+    double maxmove = 0.;
+
+    for(int g=0; g<int(m_gens.size()); ++g)
+      {
+	const generator_stats &st = m_stats[g];
+	const double n = st.m_sums.m_npix;
+
+	// lost all its pixels
+	if( st.m_sums.m_npix == 0 )
+	  {
+	    maxmove = 1e30;
+	    continue;
+	  }
+
+	generator gen( st.m_sumx/n, st.m_sumy/n, m_gens[g].m_scale );
+	const double error = m_binmod->fracerror(st.m_sums, true);
+	if( error > 0. && error < 1e30 )
+	  gen.m_scale = sqrt(n)*error/m_threshold;
+
+	const double dx = gen.m_x-m_gens[g].m_x, dy = gen.m_y-m_gens[g].m_y;
+	maxmove = std::max(maxmove, sqrt(dx*dx+dy*dy));
+
+	newgens.push_back(gen);
+      }
+
+    m_gens = newgens;
+    return maxmove;
+  }
+
+  void voronoi_binner::paint_output()
+  {
+    m_output_binmap_image.SetAll(c_masked);
+    m_out_image.SetAll(-1.);
+    m_error_image.SetAll(-1.);
+
+    // number the bins which have pixels, and get their values
+    const int nogens = m_gens.size();
+    vector<int> binno(nogens, -1);
+    vector<double> val(nogens), err(nogens);
+    int latest_bin_no = 0;
+    for(int g=0; g<nogens; ++g)
+      if( m_stats[g].m_sums.m_npix > 0 )
+	{
+	  binno[g] = latest_bin_no++;
+	  val[g] = m_binmod->value(m_stats[g].m_sums);
+	  err[g] = m_binmod->fracerror(m_stats[g].m_sums, false);
+	}
+
+    for(int y=0; y<m_yw; ++y)
+      for(int x=0; x<m_xw; ++x)
+	{
+	  const int g = m_assign[x+y*m_xw];
+	  if( g < 0 )
+	    continue;
+
+	  m_output_binmap_image.SetPixel(x, y, binno[g]);
+	  m_out_image.SetPixel(x, y, val[g]);
+	  m_error_image.SetPixel(x, y, err[g]);
+	}
+
+    cout << "Made " << latest_bin_no << " bins" << endl;
+  }
+
+} // namespace
+
+
+///////////////////////////////////////////////////////////////////////
+// Program class
+
+class prog
+{
+public:
+  prog(int argc, char **argv);
+  ~prog();
+  void run();
+
+private:
+  void add_history_list(CFITSFile *file);
+
+public:
+  AdaptiveBin::binmodule *m_binmod;
+  double m_threshold;    // threshold value
+  string m_out_fname;    // output binned filename
+  string m_err_fname;    // output error filename
+  string m_binmap_fname; // output binmap filename
+  string m_mask_fname;   // filename of the mask to use (optional)
+  string m_value;        // quantity to bin
+  int m_iterations;      // maximum number of iterations
+  int m_threads;         // number of threads (0 for all cpus)
+  bool m_verbose;        // display verbose information
+  bool m_invert_mask;    // invert 0 and 1 in mask
+
+  vector<string> m_history_list;
+};
+
+prog::prog(int argc, char **argv)
+  : m_binmod(0),
+    m_threshold(0.1),
+    m_out_fname("vorbin_out.fits"),
+    m_err_fname("vorbin_err.fits"),
+    m_binmap_fname("vorbin_binmap.fits"),
+    m_value("count(0)"),
+    m_iterations(50),
+    m_threads(0),
+    m_verbose(false),
+    m_invert_mask(false)
+{
+  parammm::param params(argc, argv);
+  params.add_switch( parammm::pswitch("out", 'o',
+				      parammm::pstring_opt(&m_out_fname),
+				      "set out file (def vorbin_out.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("error", 'e',
+				      parammm::pstring_opt(&m_err_fname),
+				      "set error out file (def vorbin_err.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("binmap", 'n',
+				      parammm::pstring_opt(&m_binmap_fname),
+				      "set binmap out file (def vorbin_binmap.fits)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("mask", 'm',
+				      parammm::pstring_opt(&m_mask_fname),
+				      "set input mask filename (optional)",
+				      "FILE"));
+  params.add_switch( parammm::pswitch("threshold", 't',
+				      parammm::pdouble_opt(&m_threshold),
+				      "set threshold fraction (def 10%)",
+				      "VAL"));
+  params.add_switch( parammm::pswitch("value", 'v',
+				      parammm::pstring_opt(&m_value),
+				      "set output value (eg count(0), "
+				      "ratio(1,2))", "STR") );
+  params.add_switch( parammm::pswitch("iterations", 'i',
+				      parammm::pint_opt(&m_iterations),
+				      "set maximum number of iterations "
+				      "(def 50)",
+				      "INT"));
+  params.add_switch( parammm::pswitch("threads", 'j',
+				      parammm::pint_opt(&m_threads),
+				      "set number of threads (def all cpus)",
+				      "INT"));
+  params.add_switch( parammm::pswitch("invertmask", 0,
+				      parammm::pbool_noopt(&m_invert_mask),
+				      "invert input mask image",
+				      ""));
+  params.add_switch( parammm::pswitch("verbose", 0,
+				      parammm::pbool_noopt(&m_verbose),
+				      "display more information",
+				      ""));
+
+  params.set_autohelp("Usage: VoronoiBin [OPTIONS] file bg=count...\n"
+		      "Bins a set of images with a weighted Voronoi "
+		      "tessellation\n"
+		      "Written by Jeremy Sanders, 2000, 2001.",
+		      "Report bugs to <jss@ast.cam.ac.uk>");
+  params.enable_autohelp();
+  params.enable_autoversion(c_adbin_version,
+			    "Jeremy Sanders",
+			    "Licenced under the GPL - see the file COPYING");
+  params.enable_at_expansion();
+
+  params.interpret_and_catch();
+
+  if(params.args().size() < 1)
+    params.show_autohelp();
+
+  if(m_threads <= 0)
+    m_threads = AdaptiveBin::default_threads();
+
+  try {
+    // select external if specified
+    const string first8(m_value, 0, 8);
+    if( first8 == "external" )
+      m_binmod = new AdaptiveBin::external_binmodule(params.args());
+    else
+      m_binmod = new AdaptiveBin::ratio_binmodule(params.args());
+    m_binmod->selectvalue(m_value);
+  }
+  catch(AdaptiveBin::invalidargs_exception e) {
+    clog << "Invalid files listed\n\n";
+    params.show_autohelp();
+  }
+  catch(AdaptiveBin::invalidvalue_exception e) {
+    clog << "Invalid output value\n\n";
+    params.show_autohelp();
+  }
+
+  cout << "Using value "
+       << m_binmod->get_value_descr() << endl;
+
+  {
+    // stuff to write into history in fits output files
+    m_history_list.push_back(string("file created by VoronoiBin v. ")
+			     + c_adbin_version);
+
+    for(int i = 0; i<int(params.args().size()); ++i) {
+      ostringstream o;
+      o << "arg " << i << ": " << params.args()[i];
+      m_history_list.push_back( o.str() );
+    }
+
+    m_history_list.push_back( string("output image: ") + m_out_fname );
+    m_history_list.push_back( string("error map: ") + m_err_fname );
+    m_history_list.push_back( string("bin map: ") + m_binmap_fname );
+
+    m_history_list.push_back( string("mask: ") + m_mask_fname );
+    m_history_list.push_back( string("value: ") + m_binmod->get_value_descr() );
+
+    {
+      ostringstream o;
+      o << "threshold: " << m_threshold;
+      m_history_list.push_back( o.str() );
+    }{
+      ostringstream o;
+      o << "iterations: " << m_iterations;
+      m_history_list.push_back( o.str() );
+    }
+  } // end history comments
+
+  // write history to screen if verbose option is on
+  if(m_verbose) {
+    cout << "\nHeader lines written to output files:\n";
+    for(int i=0; i<int(m_history_list.size()); ++i)
+      cout << m_history_list[i] << endl;
+    cout << endl;
+  }
+}
+
+prog::~prog()
+{
+  if(m_binmod != 0)
+    delete m_binmod;
+}
+
+void prog::add_history_list(CFITSFile *file)
+{
+  const int no = m_history_list.size();
+
+  for(int i=0; i<no; ++i) {
+    const string line = "adbin: " + m_history_list[i];
+    file -> WriteHistory(line.c_str());
+  }
+}
+
+void prog::run()
+{
+  CFITSImage out, err, pixel;
+  AdaptiveBin::voronoi_binner b(m_binmod, m_threshold, m_iterations,
+				m_threads);
+
+  if( ! m_mask_fname.empty() ) {
+    vector<bool> masked;
+    AdaptiveBin::read_mask(m_mask_fname, m_binmod->xw(), m_binmod->yw(),
+			   m_invert_mask, &masked);
+    b.set_mask(masked);
+  }
+
+  b.bin(&out, &err, &pixel);
+
+  CFITSPosn posn;
+  m_binmod -> getposn(&posn);
+
+  {
+    CFITSFile outf(m_out_fname.c_str(), CFITSFile::create);
+    outf.SetImage(out);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked bins
+    outf.WriteHistory("adbin: file is output image");
+    add_history_list( &outf );
+  }{
+    CFITSFile outf(m_err_fname.c_str(), CFITSFile::create);
+    outf.SetImage(err);
+    outf.SetPosn(posn);
+    outf.WriteImageInclNull(-1.); // ignore masked bins
+    outf.WriteHistory("adbin: file is error map");
+    add_history_list( &outf );
+  }{
+    CFITSFile outf(m_binmap_fname.c_str(), CFITSFile::create);
+    outf.SetImage(pixel);
+    outf.SetPosn(posn);
+    outf.WriteImage();
+    outf.WriteHistory("adbin: file is bin map");
+    add_history_list( &outf );
+  }
+
+}
+
+int main(int argc, char *argv[])
+{
+  prog program(argc, argv);
+  program.run();
+  return 0;
+}
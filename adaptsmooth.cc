@@ -0,0 +1,251 @@
+//      Adaptive Binning Program
+//      Adaptive smoothing using summed-area tables
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <algorithm>
+#include <cmath>
+
+#include "adaptsmooth.hh"
+#include "parallel.hh"
+
+using std::vector;
+using std::string;
+
+namespace AdaptiveBin
+{
+  // the top-hat kernel is made of at most this many bands each side of
+  // the centre; below this radius it is an exact disc
+  const int c_tophat_bands = 8;
+
+  adaptive_smoother::adaptive_smoother(binmodule *bm, double threshold,
+				       kernel k,
+				       const vector<bool> *masked)
+    : m_binmod(bm),
+      m_threshold(threshold),
+      m_kernel(k),
+      m_masked(masked),
+      m_xw(bm->xw()), m_yw(bm->yw()),
+      m_maxrad(std::max(m_xw, m_yw)),
+      m_table(bm, masked),
+      m_smoothed(0), m_scale(0)
+  {
+    if( m_kernel != tophat )
+      return;
+
+    // split each disc into bands of rows, each band having the mean
+    // half-width of its rows, so the area is close to the disc
+    m_bands.resize(m_maxrad+1);
+    for(int r=0; r<=m_maxrad; ++r)
+      {
+	const int nobands = std::min(r+1, c_tophat_bands);
+	for(int b=0; b<nobands; ++b)
+	  {
+	    band bd;
+	    bd.dylo = (r+1)*b/nobands;
+	    bd.dyhi = (r+1)*(b+1)/nobands - 1;
+
+	    double total = 0.;
+	    for(int dy=bd.dylo; dy<=bd.dyhi; ++dy)
+	      total += std::floor( std::sqrt(double(r*r - dy*dy)) );
+	    bd.halfwidth = int( total/(bd.dyhi-bd.dylo+1) + 0.5 );
+
+	    m_bands[r].push_back(bd);
+	  }
+      }
+  }
+
+  bool adaptive_smoother::lookup_kernel(const string &name, kernel *k)
+  {
+    if( name == "box" )
+      *k = box;
+    else if( name == "tophat" )
+      *k = tophat;
+    else
+      return false;
+    return true;
+  }
+
+  void adaptive_smoother::kernelsums(int x, int y, int r, binsums *sums,
+				     binsums *temp) const
+  {
+    if( m_kernel == box )
+      {
+	m_table.rectsums(x-r, y-r, x+r, y+r, sums);
+	return;
+      }
+
+    // central band covers rows either side of the pixel
+    const vector<band> &bands = m_bands[r];
+    const int w0 = bands[0].halfwidth;
+    m_table.rectsums(x-w0, y-bands[0].dyhi, x+w0, y+bands[0].dyhi, sums);
+
+    for(int b=1; b<int(bands.size()); ++b)
+      {
+	const band &bd = bands[b];
+	const int w = bd.halfwidth;
+	m_table.rectsums(x-w, y+bd.dylo, x+w, y+bd.dyhi, temp);
+	sums->add(*temp);
+	m_table.rectsums(x-w, y-bd.dyhi, x+w, y-bd.dylo, temp);
+	sums->add(*temp);
+      }
+  }
+
+  void adaptive_smoother::smooth_rows(int y1, int y2, unsigned thread)
+  {
+    binsums sums = m_binmod->newsums();
+    binsums temp = m_binmod->newsums();
+
+    for(int y=y1; y<y2; ++y)
+      for(int x=0; x<m_xw; ++x)
+	{
+	  const int i = x+y*m_xw;
+	  if( m_masked != 0 && (*m_masked)[i] )
+	    {
+	      (*m_smoothed)[i] = -1.;
+	      (*m_scale)[i] = -1.;
+	      continue;
+	    }
+
+	  // binary search for the smallest kernel reaching the error
+	  int lo = 0, hi = m_maxrad;
+	  while( lo < hi )
+	    {
+	      const int mid = (lo+hi)/2;
+	      kernelsums(x, y, mid, &sums, &temp);
+	      const double error = m_binmod->fracerror(sums, true);
+	      if( error > 0. && error <= m_threshold )
+		hi = mid;
+	      else
+		lo = mid+1;
+	    }
+
+	  kernelsums(x, y, lo, &sums, &temp);
+	  (*m_smoothed)[i] = m_binmod->value(sums);
+	  (*m_scale)[i] = lo;
+	}
+  }
+
+  void adaptive_smoother::smooth(vector<double> *smoothed,
+				 vector<double> *scale,
+				 unsigned nothreads)
+  {
+    smoothed->assign(m_xw*m_yw, 0.);
+    scale->assign(m_xw*m_yw, 0.);
+    m_smoothed = smoothed;
+    m_scale = scale;
+
+    parallel_range(this, &adaptive_smoother::smooth_rows, m_yw, nothreads);
+
+    m_smoothed = 0;
+    m_scale = 0;
+  }
+
+  /////////////////////////////////////////////////////////////////////
+
+  gaussian_smoother::gaussian_smoother(int xw, int yw, double sigma)
+    : m_xw(xw), m_yw(yw),
+      m_radius( int(std::ceil(sigma*3.)) ),
+      m_in(0), m_out(0)
+  {
+    for(int d=-m_radius; d<=m_radius; ++d)
+      m_weights.push_back( std::exp( -0.5*d*d/(sigma*sigma) ) );
+  }
+
+  void gaussian_smoother::smooth(const vector<double> &image,
+				 vector<double> *smoothed,
+				 unsigned nothreads)
+  {
+    m_in = &image;
+    m_rows.assign(m_xw*m_yw, 0.);
+    smoothed->assign(m_xw*m_yw, 0.);
+    m_out = smoothed;
+
+    parallel_range(this, &gaussian_smoother::smooth_rows,
+		   m_yw, nothreads);
+    parallel_range(this, &gaussian_smoother::smooth_columns,
+		   m_yw, nothreads);
+
+    m_in = 0;
+    m_out = 0;
+    m_rows.clear();
+  }
+
+  void gaussian_smoother::smooth_rows(int y1, int y2, unsigned thread)
+  {
+    for(int y=y1; y<y2; ++y)
+      {
+	const double *in = &(*m_in)[y*m_xw];
+	double *out = &m_rows[y*m_xw];
+
+	for(int x=0; x<m_xw; ++x)
+	  {
+	    const int dx1 = std::max(-m_radius, -x);
+	    const int dx2 = std::min(m_radius, m_xw-1-x);
+
+	    double sum = 0., norm = 0.;
+	    for(int dx=dx1; dx<=dx2; ++dx)
+	      {
+		const double v = in[x+dx];
+		if( std::isnan(v) )
+		  continue;
+		const double w = m_weights[dx+m_radius];
+		sum += w*v;
+		norm += w;
+	      }
+
+	    out[x] = norm > 0. ? sum/norm : std::nan("");
+	  }
+      }
+  }
+
+  void gaussian_smoother::smooth_columns(int y1, int y2, unsigned thread)
+  {
+    vector<double> sum(m_xw), norm(m_xw);
+
+    for(int y=y1; y<y2; ++y)
+      {
+	const int dy1 = std::max(-m_radius, -y);
+	const int dy2 = std::min(m_radius, m_yw-1-y);
+
+	// add rows of the row-smoothed image, so the inner loop runs
+	// along each row
+	sum.assign(m_xw, 0.);
+	norm.assign(m_xw, 0.);
+	for(int dy=dy1; dy<=dy2; ++dy)
+	  {
+	    const double *in = &m_rows[(y+dy)*m_xw];
+	    const double w = m_weights[dy+m_radius];
+	    for(int x=0; x<m_xw; ++x)
+	      if( ! std::isnan(in[x]) )
+		{
+		  sum[x] += w*in[x];
+		  norm[x] += w;
+		}
+	  }
+
+	double *out = &(*m_out)[y*m_xw];
+	for(int x=0; x<m_xw; ++x)
+	  out[x] = norm[x] > 0. ? sum[x]/norm[x] : std::nan("");
+      }
+  }
+
+}
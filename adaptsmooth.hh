@@ -0,0 +1,117 @@
+//      Adaptive Binning Program
+//      Adaptive smoothing using summed-area tables
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Each pixel is smoothed with the smallest kernel around it which
+// reaches the fractional error threshold. The kernel totals come from a
+// summed-area table, so each trial radius costs the same whatever its
+// size, and the radius is found by a binary search.
+
+#ifndef ADBIN_ADAPTSMOOTH_HH
+#define ADBIN_ADAPTSMOOTH_HH
+
+#include <vector>
+#include <string>
+
+#include "binmodule.hh"
+
+namespace AdaptiveBin
+{
+
+  class adaptive_smoother
+  {
+  public:
+    enum kernel { box, tophat };
+
+    adaptive_smoother(binmodule *bm, double threshold,
+		      kernel k = box,
+		      const std::vector<bool> *masked = 0);
+    // threshold is the fractional error each kernel must reach
+    // masked pixels (if given) are ignored
+
+    void smooth(std::vector<double> *smoothed,
+		std::vector<double> *scale,
+		unsigned nothreads = 1);
+    // smoothed and scale are set to the smoothed value and kernel
+    // radius of each pixel (-1 for masked pixels)
+
+    static bool lookup_kernel(const std::string &name, kernel *k);
+    // convert kernel name to kernel, returning false if unknown
+
+  private:
+    void smooth_rows(int y1, int y2, unsigned thread);
+    void kernelsums(int x, int y, int r, binsums *sums,
+		    binsums *temp) const;
+
+  private:
+    // a pair of rows dylo<=|dy|<=dyhi of half-width halfwidth which
+    // make up part of a top-hat kernel
+    struct band
+    {
+      int dylo, dyhi, halfwidth;
+    };
+
+    binmodule *m_binmod;
+    double m_threshold;
+    kernel m_kernel;
+    const std::vector<bool> *m_masked;
+    const int m_xw, m_yw;
+    const int m_maxrad;
+
+    binsumtable m_table;
+    std::vector< std::vector<band> > m_bands;   // bands for each radius
+
+    std::vector<double> *m_smoothed;
+    std::vector<double> *m_scale;
+  };
+
+  // smoothing with a fixed gaussian, done as a pass along the rows
+  // followed by a pass along the columns
+  class gaussian_smoother
+  {
+  public:
+    gaussian_smoother(int xw, int yw, double sigma);
+    // the kernel is cut off at 3 sigma
+
+    void smooth(const std::vector<double> &image,
+		std::vector<double> *smoothed,
+		unsigned nothreads = 1);
+    // blank (NaN) pixels and pixels off the image are left out of the
+    // kernel, and pixels with nothing in their kernel are set blank
+
+  private:
+    void smooth_rows(int y1, int y2, unsigned thread);
+    void smooth_columns(int y1, int y2, unsigned thread);
+
+  private:
+    const int m_xw, m_yw;
+    int m_radius;
+    std::vector<double> m_weights;   // kernel for offsets -radius..radius
+
+    const std::vector<double> *m_in;
+    std::vector<double> m_rows;      // the image smoothed along rows
+    std::vector<double> *m_out;
+  };
+
+}
+
+#endif
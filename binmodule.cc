@@ -29,6 +29,7 @@
 #include <sstream>
 #include <cassert>
 #include <cmath>
+#include <algorithm>
 #include "binmodule.hh"
 #include <FITSFile.h>
 
@@ -38,6 +39,7 @@ using std::string;
 using std::ifstream;
 using std::ostringstream;
 using std::istringstream;
+using std::vector;
 
 namespace AdaptiveBin
 {
@@ -46,13 +48,173 @@ namespace AdaptiveBin
   bool checkfileexists(const string &fn)
   {
     ifstream file(fn.c_str());
-    return( file );
+    return( file.good() );
   }
 
+  ////////////////////////////////
+
+  binsums::binsums(unsigned nototals)
+    : m_totals(nototals, 0.), m_npix(0)
+  {
+  }
+
+  void binsums::clear()
+  {
+    for(unsigned i=0; i<m_totals.size(); ++i)
+      m_totals[i] = 0.;
+    m_npix = 0;
+  }
+
+  void binsums::add(const binsums &other)
+  {
+    assert( other.m_totals.size() == m_totals.size() );
+
+    for(unsigned i=0; i<m_totals.size(); ++i)
+      m_totals[i] += other.m_totals[i];
+    m_npix += other.m_npix;
+  }
+
+  ////////////////////////////////
+
   binmodule::~binmodule()
   {
   }
 
+  binsums binmodule::newsums()
+  {
+    return binsums( nosums() );
+  }
+
+  double binmodule::fracerror(const pixlist &pl,
+			      bool binerror)
+  {
+    assert(pl.size() != 0);
+
+    binsums sums( nosums() );
+    for(int i=pl.size()-1; i>=0; i--)
+      addpixel(&sums, pl[i].x(), pl[i].y());
+
+    return fracerror(sums, binerror);
+  }
+
+  double binmodule::value(const pixlist &pl)
+  {
+    assert(pl.size() != 0);
+
+    binsums sums( nosums() );
+    for(int i=pl.size()-1; i>=0; i--)
+      addpixel(&sums, pl[i].x(), pl[i].y());
+
+    return value(sums);
+  }
+
+  ////////////////////////////////
+
+  binsumtable::binsumtable(binmodule *bm, const std::vector<bool> *masked)
+    : m_xw(bm->xw()), m_yw(bm->yw()),
+      m_nosums(bm->nosums()),
+      m_table( (m_xw+1)*(m_yw+1)*(m_nosums+1), 0. )
+  {
+    const unsigned stride = m_nosums+1;
+    binsums sums(m_nosums);
+
+    // table(x, y) is total of pixels to the left and below x, y
+    for(int y=0; y<m_yw; ++y)
+      {
+	// running totals along this row
+	vector<double> row(stride, 0.);
+
+	for(int x=0; x<m_xw; ++x)
+	  {
+	    if( masked == 0 || ! (*masked)[x+y*m_xw] )
+	      {
+		sums.clear();
+		bm->addpixel(&sums, x, y);
+		for(unsigned i=0; i<m_nosums; ++i)
+		  row[i] += sums.m_totals[i];
+		row[m_nosums] += sums.m_npix;
+	      }
+
+	    const double *below = &m_table[ ((x+1)+y*(m_xw+1))*stride ];
+	    double *here = &m_table[ ((x+1)+(y+1)*(m_xw+1))*stride ];
+	    for(unsigned i=0; i<stride; ++i)
+	      here[i] = below[i] + row[i];
+	  }
+      }
+  }
+
+  void binsumtable::rectsums(int x1, int y1, int x2, int y2,
+			     binsums *sums) const
+  {
+    x1 = std::max(x1, 0); y1 = std::max(y1, 0);
+    x2 = std::min(x2, m_xw-1); y2 = std::min(y2, m_yw-1);
+
+    sums->clear();
+    if( x1 > x2 || y1 > y2 )
+      return;
+
+    const unsigned stride = m_nosums+1;
+    const double *a = &m_table[ ((x2+1)+(y2+1)*(m_xw+1))*stride ];
+    const double *b = &m_table[ (x1+(y2+1)*(m_xw+1))*stride ];
+    const double *c = &m_table[ ((x2+1)+y1*(m_xw+1))*stride ];
+    const double *d = &m_table[ (x1+y1*(m_xw+1))*stride ];
+
+    for(unsigned i=0; i<m_nosums; ++i)
+      sums->m_totals[i] = a[i] - b[i] - c[i] + d[i];
+    sums->m_npix = int(a[m_nosums] - b[m_nosums] - c[m_nosums] +
+		       d[m_nosums] + 0.5);
+  }
+
+  ////////////////////////////////
+
+  binrowtable::binrowtable(binmodule *bm, const CFITSImage &binmap)
+    : m_xw(bm->xw()), m_yw(bm->yw()),
+      m_nosums(bm->nosums()),
+      m_table( (m_xw+1)*m_yw*(m_nosums+1), 0. )
+  {
+    const unsigned stride = m_nosums+1;
+    binsums sums(m_nosums);
+
+    // table(x, y) is total of pixels to the left of x in row y
+    for(int y=0; y<m_yw; ++y)
+      {
+	double *row = &m_table[ y*(m_xw+1)*stride ];
+	for(int x=0; x<m_xw; ++x)
+	  {
+	    const double *prev = row + x*stride;
+	    double *here = row + (x+1)*stride;
+	    for(unsigned i=0; i<stride; ++i)
+	      here[i] = prev[i];
+
+	    if( binmap.GetPixel(x, y) < -1. )
+	      {
+		sums.clear();
+		bm->addpixel(&sums, x, y);
+		for(unsigned i=0; i<m_nosums; ++i)
+		  here[i] += sums.m_totals[i];
+		here[m_nosums] += sums.m_npix;
+	      }
+	  }
+      }
+  }
+
+  void binrowtable::addspan(int y, int x1, int x2, binsums *sums) const
+  {
+    x1 = std::max(x1, 0);
+    x2 = std::min(x2, m_xw);
+    if( y < 0 || y >= m_yw || x1 >= x2 )
+      return;
+
+    const unsigned stride = m_nosums+1;
+    const double *row = &m_table[ y*(m_xw+1)*stride ];
+    const double *a = row + x1*stride;
+    const double *b = row + x2*stride;
+
+    for(unsigned i=0; i<m_nosums; ++i)
+      sums->m_totals[i] += b[i] - a[i];
+    sums->m_npix += int(b[m_nosums] - a[m_nosums] + 0.5);
+  }
+
   ////////////////////////////////
 
   count_binmodule::count_binmodule(const arglist &al)
@@ -106,27 +268,70 @@ namespace AdaptiveBin
     return m_image.GetYW();
   }
 
-  double count_binmodule::value(const pixlist &pl)
+  // sums are total counts
+  unsigned count_binmodule::nosums()
   {
-    assert(pl.size() != 0);
+    return 1;
+  }
 
-    double tot=0.;
+  void count_binmodule::addpixel(binsums *sums, int x, int y)
+  {
+    sums->m_totals[0] += m_image.GetPixel(x, y);
+    sums->m_npix ++;
+  }
+
+  double count_binmodule::value(const binsums &sums)
+  {
+    assert(sums.m_npix != 0);
+    return totvalue(sums.m_totals[0], sums.m_npix);
+  }
+
+  double count_binmodule::fracerror(const binsums &sums,
+				    bool binerror)
+  {
+    assert(sums.m_npix != 0);
+    return totfracerror(sums.m_totals[0], sums.m_npix);
+  }
+
+  double count_binmodule::pixelval(int x, int y) const
+  {
+    return m_image.GetPixel(x, y);
+  }
+
+  // total directly, rather than through binsums and addpixel, as
+  // this is called for every bin tried
+  double count_binmodule::pixlisttotal(const pixlist &pl) const
+  {
+    const CFloatType *image = m_image.GetConstImageBuffer();
+    const int xw = m_image.GetXW();
+
+    double tot = 0.;
     for(int i=pl.size()-1; i>=0; i--)
-      tot += m_image.GetPixel(pl[i].x(), pl[i].y());
+      tot += image[ pl[i].x() + pl[i].y()*xw ];
+    return tot;
+  }
 
-    return tot/pl.size() - m_background;
+  double count_binmodule::value(const pixlist &pl)
+  {
+    assert(pl.size() != 0);
+    return totvalue(pixlisttotal(pl), pl.size());
   }
 
   double count_binmodule::fracerror(const pixlist &pl,
 				    bool binerror)
   {
     assert(pl.size() != 0);
+    return totfracerror(pixlisttotal(pl), pl.size());
+  }
 
-    double tot=0.;
-    for(int i=pl.size()-1; i>=0; i--)
-      tot += m_image.GetPixel(pl[i].x(), pl[i].y());
+  double count_binmodule::totvalue(double tot, int npix) const
+  {
+    return tot/npix - m_background;
+  }
 
-    const double bg = pl.size()*m_background;
+  double count_binmodule::totfracerror(double tot, int npix) const
+  {
+    const double bg = npix*m_background;
 
     // error in tot=sqrt(tot), error in bg=sqrt(bg)
     return sqrt(tot + bg)/(tot - bg);
@@ -214,36 +419,35 @@ namespace AdaptiveBin
       return "external(0)";
   }
 
-  double external_binmodule::value(const pixlist &pl)
+  // sums are total value and total error squared
+  unsigned external_binmodule::nosums()
   {
-    assert(pl.size() != 0);
+    return 2;
+  }
 
-    // calculate average value
-    double tot=0.;
-    for(int i=pl.size()-1; i>=0; i--)
-      tot += m_image.GetPixel(pl[i].x(), pl[i].y());
+  void external_binmodule::addpixel(binsums *sums, int x, int y)
+  {
+    sums->m_totals[0] += m_image.GetPixel(x, y);
+    const double error = m_error.GetPixel(x, y);
+    sums->m_totals[1] += error*error;
+    sums->m_npix ++;
+  }
 
-    return tot/pl.size();
+  double external_binmodule::value(const binsums &sums)
+  {
+    assert(sums.m_npix != 0);
+
+    // calculate average value
+    return sums.m_totals[0]/sums.m_npix;
   }
 
-  double external_binmodule::fracerror(const pixlist &pl,
+  double external_binmodule::fracerror(const binsums &sums,
 				       bool binerror)
   {
-    assert(pl.size() != 0);
-
-    double tot = 0.;
-    double toterr_2 = 0.;
-    for(int i=pl.size()-1; i>=0; i--)
-      {
-	const unsigned x = pl[i].x();
-	const unsigned y = pl[i].y();
-	tot += m_image.GetPixel(x, y);
-	const double error = m_error.GetPixel(x, y);
-	toterr_2 += error*error;
-      }
+    assert(sums.m_npix != 0);
 
-    const double error_on_av = sqrt(toterr_2)/pl.size();
-    const double average = tot/pl.size();
+    const double error_on_av = sqrt(sums.m_totals[1])/sums.m_npix;
+    const double average = sums.m_totals[0]/sums.m_npix;
 
     if( m_absolute )
       return error_on_av;
@@ -278,38 +482,111 @@ namespace AdaptiveBin
     m_valparam[0] = m_valparam[1] = 0;
   }
 
+  // sums are total counts in each band
+  unsigned ratio_binmodule::nosums()
+  {
+    return m_counts.size();
+  }
+
+  void ratio_binmodule::addpixel(binsums *sums, int x, int y)
+  {
+    for(unsigned i=0; i<m_counts.size(); i++)
+      sums->m_totals[i] += m_counts[i].pixelval(x, y);
+    sums->m_npix ++;
+  }
+
+  double ratio_binmodule::value(const binsums &sums)
+  {
+    assert(m_valparam[0] < m_counts.size());
+    assert(m_valparam[1] < m_counts.size());
+    assert(sums.m_npix != 0);
+
+    const unsigned a = m_valparam[0], b = m_valparam[1];
+
+    switch(m_value)
+      {
+      case vcount:
+	return m_counts[a].totvalue(sums.m_totals[a], sums.m_npix);
+      case vratio:
+	return m_counts[a].totvalue(sums.m_totals[a], sums.m_npix) /
+	  m_counts[b].totvalue(sums.m_totals[b], sums.m_npix);
+      }
+
+    return -1.;
+  }
+
   double ratio_binmodule::value(const pixlist &pl)
   {
     assert(m_valparam[0] < m_counts.size());
     assert(m_valparam[1] < m_counts.size());
+    assert(pl.size() != 0);
+
+    const unsigned a = m_valparam[0], b = m_valparam[1];
 
     switch(m_value)
       {
       case vcount:
-	return m_counts[m_valparam[0]].value(pl);
+	return m_counts[a].value(pl);
       case vratio:
-	return m_counts[m_valparam[0]].value(pl) /
-	  m_counts[m_valparam[1]].value(pl);
+	return m_counts[a].value(pl) / m_counts[b].value(pl);
       }
 
     return -1.;
   }
 
+  // only the bands which are needed are totalled
   double ratio_binmodule::fracerror(const pixlist &pl,
 				    bool binerror)
   {
     assert(m_valparam[0] < m_counts.size());
     assert(m_valparam[1] < m_counts.size());
+    assert(pl.size() != 0);
+
+    const unsigned a = m_valparam[0], b = m_valparam[1];
+
+    if( ! binerror )
+      {
+	switch(m_value)
+	  {
+	  case vcount:
+	    return m_counts[a].fracerror(pl, false);
+	  case vratio:
+	    const double e1 = m_counts[a].fracerror(pl, false);
+	    const double e2 = m_counts[b].fracerror(pl, false);
+	    return sqrt(e1*e1+e2*e2);
+	  }
+	return -1.;
+      } else {
+	double totsqd = 0.;
+	for(unsigned i=0; i<m_counts.size(); i++)
+	  {
+	    const double e = m_counts[i].fracerror(pl, false);
+	    totsqd += e*e;
+	  }
+	return sqrt(totsqd);
+      }
+  }
+
+  double ratio_binmodule::fracerror(const binsums &sums,
+				    bool binerror)
+  {
+    assert(m_valparam[0] < m_counts.size());
+    assert(m_valparam[1] < m_counts.size());
+    assert(sums.m_npix != 0);
+
+    const unsigned a = m_valparam[0], b = m_valparam[1];
 
     if( ! binerror )
       {
 	switch(m_value)
 	  {
 	  case vcount:
-	    return m_counts[m_valparam[0]].fracerror(pl, binerror);
+	    return m_counts[a].totfracerror(sums.m_totals[a], sums.m_npix);
 	  case vratio:
-	    const double e1 = m_counts[m_valparam[0]].fracerror(pl, binerror);
-	    const double e2 = m_counts[m_valparam[1]].fracerror(pl, binerror);
+	    const double e1 = m_counts[a].totfracerror(sums.m_totals[a],
+						       sums.m_npix);
+	    const double e2 = m_counts[b].totfracerror(sums.m_totals[b],
+						       sums.m_npix);
 	    return sqrt(e1*e1+e2*e2);
 	  }
 	return -1.;
@@ -317,7 +594,8 @@ namespace AdaptiveBin
 	double totsqd = 0.;
 	for(unsigned i=0; i<m_counts.size(); i++)
 	  {
-	    const double e = m_counts[i].fracerror(pl, binerror);
+	    const double e = m_counts[i].totfracerror(sums.m_totals[i],
+						      sums.m_npix);
 	    totsqd += e*e;
 	  }
 	return sqrt(totsqd);
@@ -27,6 +27,9 @@
 // binmodule.hh
 // modules for binning files...
 
+#ifndef ADBIN_BINMODULE_HH
+#define ADBIN_BINMODULE_HH
+
 #include <vector>
 #include <string>
 
@@ -48,14 +51,38 @@ namespace AdaptiveBin
   typedef std::vector<pixel> pixlist;
   typedef std::vector<std::string> arglist;
 
+  // running totals for a set of pixels
+  // the totals are plain sums, so a bin can be built up a pixel at
+  // a time, or the totals of two sets of pixels added together
+  class binsums
+  {
+  public:
+    explicit binsums(unsigned nototals = 0);
+    void clear();
+    void add(const binsums &other);
+
+    std::vector<double> m_totals;
+    int m_npix;
+  };
+
   class binmodule
   {
   public:
     virtual ~binmodule();
 
+    // these evaluate a list of pixels by summing them with addpixel
+    // (modules can total the pixels directly instead)
     virtual double fracerror(const pixlist &pl,
+			     bool binerror);
+    virtual double value(const pixlist &pl);
+
+    // incremental interface
+    binsums newsums();
+    virtual unsigned nosums() = 0;
+    virtual void addpixel(binsums *sums, int x, int y) = 0;
+    virtual double fracerror(const binsums &sums,
 			     bool binerror) = 0;
-    virtual double value(const pixlist &pl) = 0;
+    virtual double value(const binsums &sums) = 0;
 
     virtual void getposn(CFITSPosn *out) = 0;
 
@@ -66,6 +93,48 @@ namespace AdaptiveBin
     virtual int yw() = 0;
   };
 
+  // summed-area table of the totals of a binmodule
+  // the totals of any rectangle of pixels are found from four lookups
+  class binsumtable
+  {
+  public:
+    binsumtable(binmodule *bm, const std::vector<bool> *masked = 0);
+    // masked pixels (if given) are left out of the totals
+
+    void rectsums(int x1, int y1, int x2, int y2,
+		  binsums *sums) const;
+    // get totals for x1<=x<=x2, y1<=y<=y2 (clipped to image)
+
+    int xw() const { return m_xw; }
+    int yw() const { return m_yw; }
+
+  private:
+    int m_xw, m_yw;
+    unsigned m_nosums;
+
+    // for each corner, the totals followed by the number of pixels
+    std::vector<double> m_table;
+  };
+
+  // running totals of a binmodule along each row of the image
+  // the totals of any span of a row are found from two lookups
+  class binrowtable
+  {
+  public:
+    binrowtable(binmodule *bm, const CFITSImage &binmap);
+    // only pixels which are unbinned (< -1) in binmap are included
+
+    void addspan(int y, int x1, int x2, binsums *sums) const;
+    // add totals for x1<=x<x2 in row y (clipped to image) to sums
+
+  private:
+    int m_xw, m_yw;
+    unsigned m_nosums;
+
+    // for each pixel, the totals followed by the number of pixels
+    std::vector<double> m_table;
+  };
+
   class invalidargs_exception
   {};
   class invalidvalue_exception
@@ -79,9 +148,23 @@ namespace AdaptiveBin
     count_binmodule(const std::string &fname,
 		    double background);
 
+    using binmodule::fracerror;
+    using binmodule::value;
+
     double fracerror(const pixlist &pl, bool binerror);
     double value(const pixlist &pl);
 
+    unsigned nosums();
+    void addpixel(binsums *sums, int x, int y);
+    double fracerror(const binsums &sums, bool binerror);
+    double value(const binsums &sums);
+
+    // evaluate total counts tot in npix pixels
+    double pixelval(int x, int y) const;
+    double pixlisttotal(const pixlist &pl) const;
+    double totvalue(double tot, int npix) const;
+    double totfracerror(double tot, int npix) const;
+
     void getposn(CFITSPosn *out);
 
     void selectvalue(const std::string &spec);
@@ -106,8 +189,13 @@ namespace AdaptiveBin
   public:
     external_binmodule(const arglist &al);
 
-    double fracerror(const pixlist &pl, bool binerror);
-    double value(const pixlist &pl);
+    using binmodule::fracerror;
+    using binmodule::value;
+
+    unsigned nosums();
+    void addpixel(binsums *sums, int x, int y);
+    double fracerror(const binsums &sums, bool binerror);
+    double value(const binsums &sums);
 
     void getposn(CFITSPosn *out);
 
@@ -128,10 +216,18 @@ namespace AdaptiveBin
   {
   public:
     ratio_binmodule(const arglist &al);
-    
+
+    using binmodule::fracerror;
+    using binmodule::value;
+
     double fracerror(const pixlist &pl, bool binerror);
     double value(const pixlist &pl);
 
+    unsigned nosums();
+    void addpixel(binsums *sums, int x, int y);
+    double fracerror(const binsums &sums, bool binerror);
+    double value(const binsums &sums);
+
     void getposn(CFITSPosn *out);
 
     void selectvalue(const std::string &spec);
@@ -149,3 +245,5 @@ namespace AdaptiveBin
   };
 
 }
+
+#endif
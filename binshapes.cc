@@ -0,0 +1,201 @@
+//      Adaptive Binning Program
+//      Candidate bin shapes for the binner
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <cstdlib>
+
+#include "binshapes.hh"
+
+using std::string;
+using std::vector;
+
+namespace AdaptiveBin
+{
+
+  namespace {
+
+    // pairs of triangles split along each diagonal
+    void triangle_shape(int size, stencil_list *out)
+    {
+      stencil s[4] = { stencil(size), stencil(size), stencil(size),
+		       stencil(size) };
+
+      for(int sy=0; sy<size; ++sy)
+	{
+	  s[0].lo[sy] = 0;           s[0].hi[sy] = sy+1;     // sx <= sy
+	  s[1].lo[sy] = sy+1;        s[1].hi[sy] = size;
+	  s[2].lo[sy] = size-sy;     s[2].hi[sy] = size;     // sx >= size-sy
+	  s[3].lo[sy] = 0;           s[3].hi[sy] = size-sy;
+	}
+
+      out->insert(out->end(), s, s+4);
+    }
+
+    // the same triangles one pixel out (an old bug fix)
+    void offset_triangle_shape(int size, stencil_list *out)
+    {
+      stencil s[4] = { stencil(size), stencil(size), stencil(size),
+		       stencil(size) };
+
+      for(int sy=0; sy<size; ++sy)
+	{
+	  s[0].lo[sy] = 0;           s[0].hi[sy] = sy;       // sx <= sy-1
+	  s[1].lo[sy] = sy;          s[1].hi[sy] = size;
+	  s[2].lo[sy] = size-sy-1;   s[2].hi[sy] = size;     // sx >= size-sy-1
+	  s[3].lo[sy] = 0;           s[3].hi[sy] = size-sy-1;
+	}
+
+      out->insert(out->end(), s, s+4);
+    }
+
+    // rectangles of half the tile, split in each direction
+    void halfsquare_shape(int size, stencil_list *out)
+    {
+      stencil s[4] = { stencil(size), stencil(size), stencil(size),
+		       stencil(size) };
+
+      for(int sy=0; sy<size; ++sy)
+	{
+	  s[0].lo[sy] = 0;           s[0].hi[sy] = size/2;   // sx < size/2
+	  s[1].lo[sy] = size/2;      s[1].hi[sy] = size;
+	  if( sy < size/2 )                                  // sy < size/2
+	    s[2].hi[sy] = size;
+	  else
+	    s[3].hi[sy] = size;
+	}
+
+      out->insert(out->end(), s, s+4);
+    }
+
+    // diamond touching the middle of each side of the tile
+    void diamond_shape(int size, stencil_list *out)
+    {
+      stencil s(size);
+
+      // pixel centres with |2sx+1-size| + |2sy+1-size| <= size
+      for(int sy=0; sy<size; ++sy)
+	{
+	  const int half = size - std::abs(2*sy+1-size);
+	  s.lo[sy] = (size-half) / 2;
+	  s.hi[sy] = (size+half+1) / 2;
+	}
+
+      out->push_back(s);
+    }
+
+  }
+
+  shape_registry::shape_registry()
+  {
+    // squares are made by the normal passes
+    add("square", 0);
+    add("triangle", triangle_shape);
+    add("halfsquare", halfsquare_shape);
+    // tried after the half-squares, as they always have been
+    add("triangle", offset_triangle_shape);
+    add("diamond", diamond_shape);
+  }
+
+  void shape_registry::add(const string &name, shape_fn fn)
+  {
+    entry e;
+    e.name = name;
+    e.fn = fn;
+    e.selected = false;
+    m_shapes.push_back(e);
+  }
+
+  bool shape_registry::select(const string &names)
+  {
+    for(unsigned i=0; i<m_shapes.size(); ++i)
+      m_shapes[i].selected = false;
+
+    string::size_type start = 0;
+    for(;;)
+      {
+	const string::size_type comma = names.find(',', start);
+	const string name = names.substr(start, comma == string::npos ?
+					 string::npos : comma-start);
+
+	bool found = false;
+	for(unsigned i=0; i<m_shapes.size(); ++i)
+	  if( m_shapes[i].name == name )
+	    {
+	      m_shapes[i].selected = true;
+	      found = true;
+	    }
+	if( ! found )
+	  return false;
+
+	if( comma == string::npos )
+	  break;
+	start = comma+1;
+      }
+
+    return true;
+  }
+
+  bool shape_registry::selected(const string &name) const
+  {
+    for(unsigned i=0; i<m_shapes.size(); ++i)
+      if( m_shapes[i].name == name )
+	return m_shapes[i].selected;
+    return false;
+  }
+
+  bool shape_registry::any_stencils() const
+  {
+    for(unsigned i=0; i<m_shapes.size(); ++i)
+      if( m_shapes[i].selected && m_shapes[i].fn != 0 )
+	return true;
+    return false;
+  }
+
+  void shape_registry::make_stencils(int size, stencil_list *out) const
+  {
+    out->clear();
+    for(unsigned i=0; i<m_shapes.size(); ++i)
+      if( m_shapes[i].selected && m_shapes[i].fn != 0 )
+	(*m_shapes[i].fn)(size, out);
+  }
+
+  string shape_registry::names() const
+  {
+    string out;
+    for(unsigned i=0; i<m_shapes.size(); ++i)
+      {
+	// a shape can be registered more than once
+	bool seen = false;
+	for(unsigned j=0; j<i; ++j)
+	  if( m_shapes[j].name == m_shapes[i].name )
+	    seen = true;
+	if( seen )
+	  continue;
+
+	if( ! out.empty() )
+	  out += ',';
+	out += m_shapes[i].name;
+      }
+    return out;
+  }
+
+}
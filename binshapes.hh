@@ -0,0 +1,89 @@
+//      Adaptive Binning Program
+//      Candidate bin shapes for the binner
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Shapes are made of stencils, each covering a single span of every
+// row of a size x size tile, so the totals of a stencil can be found
+// from a binrowtable with one lookup per row.
+
+#ifndef ADBIN_BINSHAPES_HH
+#define ADBIN_BINSHAPES_HH
+
+#include <vector>
+#include <string>
+
+namespace AdaptiveBin
+{
+
+  // row sy of the stencil covers lo[sy] <= sx < hi[sy]
+  class stencil
+  {
+  public:
+    explicit stencil(int size) : lo(size, 0), hi(size, 0) {}
+    bool contains(int sx, int sy) const
+    { return sx >= lo[sy] && sx < hi[sy]; }
+
+    std::vector<int> lo, hi;
+  };
+
+  typedef std::vector<stencil> stencil_list;
+
+  // function to add the stencils of a shape for tiles of side size
+  typedef void (*shape_fn)(int size, stencil_list *out);
+
+  class shape_registry
+  {
+  public:
+    shape_registry();
+    // the built in shapes are registered
+
+    void add(const std::string &name, shape_fn fn);
+    // register another shape (or more stencils for a shape)
+
+    bool select(const std::string &names);
+    // select shapes from a comma separated list
+    // returns false if a name is unknown
+
+    bool selected(const std::string &name) const;
+    bool any_stencils() const;
+    // whether any selected shape has stencils (square has none, as
+    // squares are made by the normal binning passes)
+
+    void make_stencils(int size, stencil_list *out) const;
+    // make stencils of selected shapes, in the order registered
+
+    std::string names() const;
+    // comma separated list of registered shapes
+
+  private:
+    struct entry
+    {
+      std::string name;
+      shape_fn fn;
+      bool selected;
+    };
+    std::vector<entry> m_shapes;
+  };
+
+}
+
+#endif
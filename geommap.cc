@@ -0,0 +1,187 @@
+//      Adaptive Binning Program
+//      Geometric binmaps: annuli, rays and regular grids
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <cmath>
+
+#include "geommap.hh"
+#include "radiusmap.hh"
+#include "parallel.hh"
+
+using std::vector;
+
+namespace AdaptiveBin
+{
+
+  atan_table::atan_table()
+    : m_table(c_size+2)
+  {
+    // one extra entry so t = 1 can be interpolated
+    for(int i=0; i<=c_size+1; ++i)
+      m_table[i] = std::atan( double(i) / c_size );
+  }
+
+  double atan_table::angle(double dy, double dx) const
+  {
+    const double ax = std::fabs(dx), ay = std::fabs(dy);
+    if( ax == 0. && ay == 0. )
+      return 0.;
+
+    // reduce to the first octant, then reflect back
+    double theta;
+    if( ay <= ax )
+      theta = atan_unit(ay/ax);
+    else
+      theta = M_PI_2 - atan_unit(ax/ay);
+
+    if( dx < 0. )
+      theta = M_PI - theta;
+    if( dy < 0. )
+      theta = -theta;
+    return theta;
+  }
+
+  /////////////////////////////////////////////////////////////////////
+
+  geom_binmap::geom_binmap(int xw, int yw, const vector<bool> *mask,
+			   unsigned nothreads)
+    : m_xw(xw), m_yw(yw),
+      m_mask(mask),
+      m_nothreads(nothreads),
+      m_type(type_grid),
+      m_xc(0.), m_yc(0.),
+      m_width(1.),
+      m_axis_ratio(1.), m_pa(0.),
+      m_norays(1),
+      m_start_angle(0.),
+      m_size(1),
+      m_bins(xw*yw)
+  {
+  }
+
+  void geom_binmap::annuli(double xc, double yc, double width,
+			   double axis_ratio, double pa)
+  {
+    m_type = type_annuli;
+    m_xc = xc; m_yc = yc;
+    m_width = width;
+    m_axis_ratio = axis_ratio; m_pa = pa;
+    parallel_range(this, &geom_binmap::fill_rows, m_yw, m_nothreads);
+  }
+
+  void geom_binmap::rays(double xc, double yc, int norays,
+			 double start_angle)
+  {
+    m_type = type_rays;
+    m_xc = xc; m_yc = yc;
+    m_norays = norays;
+    m_start_angle = start_angle;
+    parallel_range(this, &geom_binmap::fill_rows, m_yw, m_nothreads);
+  }
+
+  void geom_binmap::annuli_rays(double xc, double yc, double width,
+				int norays, double start_angle,
+				double axis_ratio, double pa)
+  {
+    m_type = type_annuli_rays;
+    m_xc = xc; m_yc = yc;
+    m_width = width;
+    m_norays = norays;
+    m_start_angle = start_angle;
+    m_axis_ratio = axis_ratio; m_pa = pa;
+    parallel_range(this, &geom_binmap::fill_rows, m_yw, m_nothreads);
+  }
+
+  void geom_binmap::grid(int size)
+  {
+    m_type = type_grid;
+    m_size = size;
+    parallel_range(this, &geom_binmap::fill_rows, m_yw, m_nothreads);
+  }
+
+  void geom_binmap::fill_rows(int y1, int y2, unsigned thread)
+  {
+    const bool do_annuli = m_type == type_annuli ||
+      m_type == type_annuli_rays;
+    const bool do_rays = m_type == type_rays ||
+      m_type == type_annuli_rays;
+
+    const ellipse_radius ellipse(m_xc, m_yc, m_axis_ratio, m_pa);
+    const double rayangle = 360./m_norays;
+    const int gridw = (m_xw + m_size - 1) / m_size;
+
+    vector<double> rsqd(m_xw);
+
+    for(int y=y1; y<y2; ++y)
+      {
+	int *row = &m_bins[y*m_xw];
+
+	if( m_type == type_grid )
+	  {
+	    const int rowbin = (y/m_size) * gridw;
+	    for(int x=0; x<m_xw; ++x)
+	      row[x] = rowbin + x/m_size;
+	  }
+
+	if( do_annuli )
+	  {
+	    ellipse.row_sqd(y, m_xw, &rsqd[0]);
+	    for(int x=0; x<m_xw; ++x)
+	      row[x] = int( std::sqrt(rsqd[x]) / m_width );
+	  }
+
+	if( do_rays )
+	  {
+	    const double dy = y - m_yc;
+	    for(int x=0; x<m_xw; ++x)
+	      {
+		const double angle = m_atan.angle(dy, x - m_xc) * 180.0 / M_PI;
+
+		// angle from the start, in [0, 360)
+		double da = angle - m_start_angle;
+		da -= 360. * std::floor(da / 360.);
+
+		int ray = int( da / rayangle );
+		if( ray >= m_norays )    // rounding just below 360
+		  ray -= m_norays;
+
+		if( do_annuli )
+		  row[x] = row[x]*m_norays + ray;
+		else
+		  row[x] = ray;
+	      }
+	  }
+
+	if( m_mask != 0 )
+	  mask_row(y);
+      }
+  }
+
+  void geom_binmap::mask_row(int y)
+  {
+    const int offset = y*m_xw;
+    for(int x=0; x<m_xw; ++x)
+      if( (*m_mask)[offset+x] )
+	m_bins[offset+x] = -1;
+  }
+
+}
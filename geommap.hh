@@ -0,0 +1,116 @@
+//      Adaptive Binning Program
+//      Geometric binmaps: annuli, rays and regular grids
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Binmaps which depend only on the position of each pixel, shared by
+// AnnuliMap, RayMap and BinOnGrid. Only the image size is needed, and
+// the map is filled row by row in several threads.
+
+#ifndef ADBIN_GEOMMAP_HH
+#define ADBIN_GEOMMAP_HH
+
+#include <vector>
+
+namespace AdaptiveBin
+{
+
+  // atan2 reduced to atan(t) for 0 <= t <= 1 by symmetry, taken from
+  // an interpolated table
+  class atan_table
+  {
+  public:
+    atan_table();
+
+    double angle(double dy, double dx) const;
+    // the same as atan2(dy, dx), in radians (0 at the origin)
+
+  private:
+    double atan_unit(double t) const
+    {
+      const double pos = t * c_size;
+      const int i = int(pos);
+      return m_table[i] + (pos-i)*(m_table[i+1]-m_table[i]);
+    }
+
+  private:
+    static const int c_size = 65536;
+    std::vector<double> m_table;   // atan(i/c_size), 0 <= i <= c_size+1
+  };
+
+  class geom_binmap
+  {
+  public:
+    geom_binmap(int xw, int yw, const std::vector<bool> *mask = 0,
+		unsigned nothreads = 1);
+    // mask, if given, is xw*yw with masked pixels set; they are
+    // given bin -1
+
+    void annuli(double xc, double yc, double width,
+		double axis_ratio = 1., double pa = 0.);
+    // annuli of width pixels along the major axis about a centre
+    // (see ellipse_radius for axis_ratio and pa)
+
+    void rays(double xc, double yc, int norays, double start_angle = 0.);
+    // norays sectors of equal angle about a centre, numbered
+    // anticlockwise from start_angle (degrees from the x axis)
+
+    void annuli_rays(double xc, double yc, double width, int norays,
+		     double start_angle = 0.,
+		     double axis_ratio = 1., double pa = 0.);
+    // each annulus split into rays, bin annulus*norays + ray
+
+    void grid(int size);
+    // square bins of size pixels, numbered along rows from the origin
+
+    int xw() const { return m_xw; }
+    int yw() const { return m_yw; }
+
+    const std::vector<int> &bins() const { return m_bins; }
+    // the bin of each pixel, row by row
+
+  private:
+    void fill_rows(int y1, int y2, unsigned thread);
+    void mask_row(int y);
+
+  private:
+    enum map_type { type_annuli, type_rays, type_annuli_rays, type_grid };
+
+    const int m_xw, m_yw;
+    const std::vector<bool> *m_mask;
+    const unsigned m_nothreads;
+
+    // parameters of the map being made
+    map_type m_type;
+    double m_xc, m_yc;
+    double m_width;
+    double m_axis_ratio, m_pa;
+    int m_norays;
+    double m_start_angle;
+    int m_size;
+
+    atan_table m_atan;
+    std::vector<int> m_bins;
+  };
+
+}
+
+#endif
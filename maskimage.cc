@@ -0,0 +1,68 @@
+//      Adaptive Binning Program
+//      Reading mask images
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+#include <FITSFile.h>
+#include "maskimage.hh"
+
+using std::vector;
+using std::string;
+
+namespace AdaptiveBin
+{
+
+  // rows read from the mask file at once
+  const int c_mask_block_rows = 256;
+
+  void read_mask(const string &filename, int xw, int yw,
+		 bool invert, vector<bool> *masked)
+  {
+    CFITSFile f(filename.c_str(), CFITSFile::existinghdr);
+
+    int mxw, myw;
+    f.ReadImageSize(&mxw, &myw);
+    if( mxw != xw || myw != yw )
+      {
+	std::cerr << "Mask image " << filename
+		  << " is not the same size as the input image\n";
+	std::exit(1);
+      }
+
+    masked->assign(xw*yw, false);
+
+    vector<CFloatType> rows(xw*c_mask_block_rows);
+    for(int y1=0; y1<yw; y1 += c_mask_block_rows)
+      {
+	const int norows = std::min(c_mask_block_rows, yw-y1);
+	f.ReadImageRows(y1, norows, &rows[0]);
+
+	const int offset = y1*xw;
+	for(int i=0; i<norows*xw; ++i)
+	  (*masked)[offset+i] = (rows[i] > 0.) != invert;
+      }
+  }
+
+}
@@ -0,0 +1,44 @@
+//      Adaptive Binning Program
+//      Reading mask images
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// Masks (as made by MakeMask) are read a block of rows at a time into
+// one bit per pixel, so the mask image is never held as doubles.
+
+#ifndef ADBIN_MASKIMAGE_HH
+#define ADBIN_MASKIMAGE_HH
+
+#include <vector>
+#include <string>
+
+namespace AdaptiveBin
+{
+
+  void read_mask(const std::string &filename, int xw, int yw,
+		 bool invert, std::vector<bool> *masked);
+  // set masked for each pixel of the mask (row by row): pixels > 0
+  // are masked, or pixels <= 0 if invert is set
+  // exits if the mask is not xw by yw
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+//      Adaptive Binning Program
+//      Helpers for splitting work between threads
+//      Copyright (C) 2000 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#ifndef ADBIN_PARALLEL_HH
+#define ADBIN_PARALLEL_HH
+
+#include <vector>
+#include <thread>
+
+namespace AdaptiveBin {
+
+  // number of threads to use if the user doesn't say
+  inline unsigned default_threads()
+  {
+    const unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+  }
+
+  // split the range [0, n) into nothreads contiguous chunks, and call
+  // (obj->*fn)(start, end, threadno) on each chunk in its own thread
+  // returns when all the chunks are done
+  template<class C>
+  void parallel_range(C *obj, void (C::*fn)(int, int, unsigned),
+		      int n, unsigned nothreads)
+  {
+    if( int(nothreads) > n )
+      nothreads = n;
+    if( nothreads <= 1 ) {
+      (obj->*fn)(0, n, 0);
+      return;
+    }
+
+    std::vector<std::thread> threads;
+    for(unsigned t=0; t<nothreads; ++t) {
+      const int start = int( (long long)(n)*t/nothreads );
+      const int end = int( (long long)(n)*(t+1)/nothreads );
+      threads.push_back( std::thread(fn, obj, start, end, t) );
+    }
+
+    for(unsigned t=0; t<nothreads; ++t)
+      threads[t].join();
+  }
+
+}
+
+#endif
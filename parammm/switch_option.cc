@@ -112,6 +112,18 @@ namespace parammm
     return new pstring_opt(m_p);
   }
 
+  void pstringlist_opt::setfromstream(std::istream *str) const
+  {
+    string s;
+    getline(*str, s, char(1));
+    m_p->push_back(s);
+  }
+
+  pstringlist_opt* pstringlist_opt::makecopy() const
+  {
+    return new pstringlist_opt(m_p);
+  }
+
   void pchar_opt::setfromstream(std::istream *str) const
   {
     string s;
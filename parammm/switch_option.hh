@@ -29,6 +29,7 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
 
 namespace parammm {
 
@@ -89,6 +90,17 @@ namespace parammm {
     std::string *m_p;
   };
 
+  // read a c++ string each time the switch is given, appending it
+  // to the list
+  class pstringlist_opt : public switch_opt {
+  public:
+    pstringlist_opt(std::vector<std::string> *p) : m_p(p) {}
+    pstringlist_opt* makecopy() const;
+  private:
+    void setfromstream(std::istream *stream) const;
+    std::vector<std::string> *m_p;
+  };
+
   // read a char str, option size parameter specifies max len
   class pchar_opt : public switch_opt {
   public:
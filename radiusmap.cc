@@ -0,0 +1,77 @@
+//      Adaptive Binning Program
+//      Radius and angle maps for annuli
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+#include <cmath>
+
+#include "radiusmap.hh"
+#include "parallel.hh"
+
+namespace AdaptiveBin
+{
+
+  ellipse_radius::ellipse_radius(double xc, double yc,
+				 double axis_ratio, double pa)
+    : m_xc(xc), m_yc(yc),
+      m_inv_axis_ratio(1./axis_ratio),
+      m_cos_pa(1.), m_sin_pa(0.)
+  {
+    // leave circular annuli exact
+    if( pa != 0. )
+      {
+	m_cos_pa = std::cos(pa * M_PI / 180.);
+	m_sin_pa = std::sin(pa * M_PI / 180.);
+      }
+  }
+
+  radius_map::radius_map(int xw, int yw, double xc, double yc,
+			 double axis_ratio, double pa,
+			 bool angles, unsigned nothreads)
+    : m_xw(xw), m_yw(yw),
+      m_xc(xc), m_yc(yc),
+      m_ellipse(xc, yc, axis_ratio, pa),
+      m_angles(angles),
+      m_radius_sqd(xw*yw)
+  {
+    if( m_angles )
+      m_angle.resize(xw*yw);
+
+    parallel_range(this, &radius_map::fill_rows, m_yw, nothreads);
+  }
+
+  void radius_map::fill_rows(int y1, int y2, unsigned thread)
+  {
+    for(int y=y1; y<y2; ++y)
+      {
+	m_ellipse.row_sqd(y, m_xw, &m_radius_sqd[y*m_xw]);
+
+	if( m_angles )
+	  {
+	    const double dy = y - m_yc;
+	    double *ang = &m_angle[y*m_xw];
+	    for(int x=0; x<m_xw; ++x)
+	      ang[x] = std::atan2(dy, x - m_xc);
+	  }
+      }
+  }
+
+}
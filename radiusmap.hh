@@ -0,0 +1,101 @@
+//      Adaptive Binning Program
+//      Radius and angle maps for annuli
+//      Copyright (C) 2000, 2001 Jeremy Sanders
+//      Contact: jss@ast.cam.ac.uk
+//               Institute of Astronomy, Madingley Road,
+//               Cambridge, CB3 0HA, UK.
+
+//      See the file COPYING for full licence details.
+
+//      This program is free software; you can redistribute it and/or modify
+//      it under the terms of the GNU General Public License as published by
+//      the Free Software Foundation; either version 2 of the License, or
+//      (at your option) any later version.
+
+//      This program is distributed in the hope that it will be useful,
+//      but WITHOUT ANY WARRANTY; without even the implied warranty of
+//      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//      GNU General Public License for more details.
+
+//      You should have received a copy of the GNU General Public License
+//      along with this program; if not, write to the Free Software
+//      Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+// The (elliptical) radius and angle of every pixel about a centre are
+// computed once, so annuli and sectors can be found by lookup rather
+// than by recomputing the distance and atan2 on every scan.
+
+#ifndef ADBIN_RADIUSMAP_HH
+#define ADBIN_RADIUSMAP_HH
+
+#include <vector>
+
+namespace AdaptiveBin
+{
+
+  // the radius of pixels along the major axis of ellipses about a centre
+  class ellipse_radius
+  {
+  public:
+    ellipse_radius(double xc, double yc,
+		   double axis_ratio = 1., double pa = 0.);
+    // axis_ratio is minor/major axis of the ellipses, and pa the
+    // angle of the major axis from the x axis (degrees, anticlockwise)
+
+    void row_sqd(int y, int xw, double *rsqd) const
+    {
+      const double dy = y - m_yc;
+
+      // no branches, so the compiler can vectorise the row
+      for(int x=0; x<xw; ++x)
+	{
+	  const double dx = x - m_xc;
+	  const double major = dx*m_cos_pa + dy*m_sin_pa;
+	  const double minor = (dy*m_cos_pa - dx*m_sin_pa) *
+	    m_inv_axis_ratio;
+	  rsqd[x] = major*major + minor*minor;
+	}
+    }
+    // set the squared radius of pixels 0 <= x < xw in row y
+
+  private:
+    double m_xc, m_yc;
+    double m_inv_axis_ratio;
+    double m_cos_pa, m_sin_pa;
+  };
+
+  class radius_map
+  {
+  public:
+    radius_map(int xw, int yw, double xc, double yc,
+	       double axis_ratio = 1., double pa = 0.,
+	       bool angles = false, unsigned nothreads = 1);
+    // axis_ratio and pa are as for ellipse_radius
+    // if angles is set, the angle of each pixel is also computed
+
+    int xw() const { return m_xw; }
+    int yw() const { return m_yw; }
+
+    double radius_sqd(int x, int y) const { return m_radius_sqd[x+y*m_xw]; }
+    // square of the radius along the major axis of the ellipse
+    // through the pixel
+
+    double angle(int x, int y) const { return m_angle[x+y*m_xw]; }
+    // atan2(dy, dx) of the pixel from the centre (only if angles set)
+
+  private:
+    void fill_rows(int y1, int y2, unsigned thread);
+
+  private:
+    const int m_xw, m_yw;
+    const double m_xc, m_yc;
+    const ellipse_radius m_ellipse;
+    const bool m_angles;
+
+    std::vector<double> m_radius_sqd;
+    std::vector<double> m_angle;
+  };
+
+}
+
+#endif